@@ -47,52 +47,188 @@ enum instructions {
     OP_TRAP,        // Trap                         TRAP    [REG] [NUMREG]
 
     OP_PRINT,       // Print register               PRT     [REG]
+
+    OP_PUSH,        // Push register                PUSH    [REG]
+    OP_POP,         // Pop register                 POP     [REG]
+    OP_CALL,        // Call subroutine              CALL    [ADDRREG]
+    OP_RET,         // Return from subroutine       RET
+
+    OP_SPAWN,       // Start thread                 SPAWN   [DEST] [ADDRREG] [STACKREG]
+    OP_JOIN,        // Wait for thread              JOIN    [DEST] [REG]
+    OP_CAS,         // Compare and swap             CAS     [DEST] [ADDRREG] [REG]
+    OP_FADD,        // Fetch and add                FADD    [DEST] [ADDRREG] [REG]
+    OP_XCHG,        // Exchange                     XCHG    [DEST] [ADDRREG] [REG]
+    OP_FENCE,       // Memory fence                 FENCE
+
+    OP_LDB,         // Load byte                    LDB     [DEST] [BASEREG] [OFFSET]
+    OP_LDBS,        // Load signed byte             LDBS    [DEST] [BASEREG] [OFFSET]
+    OP_LDH,         // Load 16 bits                 LDH     [DEST] [BASEREG] [OFFSET]
+    OP_LDHS,        // Load signed 16 bits          LDHS    [DEST] [BASEREG] [OFFSET]
+    OP_LDW,         // Load 32 bits                 LDW     [DEST] [BASEREG] [OFFSET]
+    OP_LDWS,        // Load signed 32 bits          LDWS    [DEST] [BASEREG] [OFFSET]
+    OP_LDQ,         // Load 64 bits                 LDQ     [DEST] [BASEREG] [OFFSET]
+    OP_STB,         // Store byte                   STB     [REG] [BASEREG] [OFFSET]
+    OP_STH,         // Store 16 bits                STH     [REG] [BASEREG] [OFFSET]
+    OP_STW,         // Store 32 bits                STW     [REG] [BASEREG] [OFFSET]
+    OP_STQ,         // Store 64 bits                STQ     [REG] [BASEREG] [OFFSET]
+
+    OP_SLT,         // Set if less than             SLT     [DEST] [REG] [REG]
+    OP_SLTU,        // Set if below                 SLTU    [DEST] [REG] [REG]
+    OP_SLE,         // Set if less or equal         SLE     [DEST] [REG] [REG]
+    OP_SLEU,        // Set if below or equal        SLEU    [DEST] [REG] [REG]
+    OP_SEL,         // Select if not zero           SEL     [DEST] [REG] [REG]
+
+    OP_BEQ,         // Branch if equal              BEQ     [REG] [REG] [ADDRREG]
+    OP_BNE,         // Branch if not equal          BNE     [REG] [REG] [ADDRREG]
+    OP_BLT,         // Branch if less than          BLT     [REG] [REG] [ADDRREG]
+    OP_BLTU,        // Branch if below              BLTU    [REG] [REG] [ADDRREG]
+
+    OP_FADDD,       // Float add                    FADDD   [DEST] [REG] [REG]
+    OP_FSUBD,       // Float subtract               FSUBD   [DEST] [REG] [REG]
+    OP_FMULD,       // Float multiply               FMULD   [DEST] [REG] [REG]
+    OP_FDIVD,       // Float divide                 FDIVD   [DEST] [REG] [REG]
+    OP_FMAD,        // Fused multiply add           FMAD    [DEST] [REG] [REG]
+    OP_FSQRTD,      // Float square root            FSQRTD  [DEST] [REG]
+    OP_FEQD,        // Float equal                  FEQD    [DEST] [REG] [REG]
+    OP_FLTD,        // Float less than              FLTD    [DEST] [REG] [REG]
+    OP_FLED,        // Float less or equal          FLED    [DEST] [REG] [REG]
+    OP_ITOF,        // Integer to float             ITOF    [DEST] [REG]
+    OP_FTOI,        // Float to integer             FTOI    [DEST] [REG]
 };
 
 /* Register amount */
-#define NUM_REGISTERS 8
+#define NUM_REGISTERS 16
+
+/* Traps, must be kept in sync with include/trap.h */
+enum traps {
+    TRAP_PUTC = 0, TRAP_GETC, TRAP_SNAPSHOT, TRAP_SEND, TRAP_RECV, TRAP_CLOSE, TRAP_READ,
+    TRAP_WRITE, TRAP_WRITEV, TRAP_MMAP, TRAP_MUNMAP, TRAP_CLOCK, TRAP_COUNTER, TRAP_PUTF,
+};
+
+/* Most argument registers read by a trap, from its value register on */
+#define TRAP_MAX_ARGS 5
 
-/* Structure of instruction */
+/* Byte code header, must be kept in sync with include/bytecode.h */
+#define BYTECODE_MAGIC "\x7fRVM"
+#define BYTECODE_VERSION 2
+
+/* Structure of instruction, operands are 'r' register or 'i' 8 bytes immediate */
 typedef struct {
     char* mnemonic;
     int opcode;
-    int num_operands;
+    char* operands;
 } instruction_info;
 
 /* Instruction table */
 instruction_info instruction_table[] = {
-    {"HLT",     OP_HALT,        0},
-    {"LD",      OP_LOAD,        2},
-    {"LA",      OP_LA,          2},
-    {"SA",      OP_SA,          2},
-    {"MOV",     OP_MOV,         2},
+    {"HLT",     OP_HALT,        ""},
+    {"LD",      OP_LOAD,        "ri"},
+    {"LA",      OP_LA,          "ri"},
+    {"SA",      OP_SA,          "ri"},
+    {"MOV",     OP_MOV,         "rr"},
+
+    {"ADD",     OP_ADD,         "rrr"},
+    {"SUB",     OP_SUB,         "rrr"},
+    {"MUL",     OP_MULTI,       "rrr"},
+    {"DIV",     OP_DIVIDE,      "rrr"},
+
+    {"INC",     OP_INCREASE,    "r"},
+    {"DEC",     OP_DECREASE,    "r"},
+
+    {"AND",     OP_AND,         "rrr"},
+    {"NOT",     OP_NOT,         "r"},
+    {"OR",      OP_OR,          "rrr"},
+    {"XOR",     OP_XOR,         "rrr"},
+    {"CMP",     OP_CMP,         "rrr"},
+
+    {"JMP",     OP_JUMP,        "r"},
+    {"JNZ",     OP_JNZ,         "rr"},
+    {"JZ",      OP_JZ,          "rr"},
+    {"LOOP",    OP_LOOP,        "rr"},
 
-    {"ADD",     OP_ADD,         3},
-    {"SUB",     OP_SUB,         3},
-    {"MUL",     OP_MULTI,       3},
-    {"DIV",     OP_DIVIDE,      3},
+    {"TRAP",    OP_TRAP,        "rr"},
 
-    {"INC",     OP_INCREASE,    1},
-    {"DEC",     OP_DECREASE,    1},
+    {"PRT",     OP_PRINT,       "r"},
 
-    {"AND",     OP_AND,         3},
-    {"NOT",     OP_NOT,         1},
-    {"OR",      OP_OR,          3},
-    {"XOR",     OP_XOR,         3},
-    {"CMP",     OP_CMP,         3},
+    {"PUSH",    OP_PUSH,        "r"},
+    {"POP",     OP_POP,         "r"},
+    {"CALL",    OP_CALL,        "r"},
+    {"RET",     OP_RET,         ""},
 
-    {"JMP",     OP_JUMP,        1},
-    {"JNZ",     OP_JNZ,         2},
-    {"JZ",      OP_JZ,          2},
-    {"LOOP",    OP_LOOP,        2},
+    {"SPAWN",   OP_SPAWN,       "rrr"},
+    {"JOIN",    OP_JOIN,        "rr"},
+    {"CAS",     OP_CAS,         "rrr"},
+    {"FADD",    OP_FADD,        "rrr"},
+    {"XCHG",    OP_XCHG,        "rrr"},
+    {"FENCE",   OP_FENCE,       ""},
 
-    {"TRAP",    OP_TRAP,        2},
+    {"LDB",     OP_LDB,         "rri"},
+    {"LDBS",    OP_LDBS,        "rri"},
+    {"LDH",     OP_LDH,         "rri"},
+    {"LDHS",    OP_LDHS,        "rri"},
+    {"LDW",     OP_LDW,         "rri"},
+    {"LDWS",    OP_LDWS,        "rri"},
+    {"LDQ",     OP_LDQ,         "rri"},
+    {"STB",     OP_STB,         "rri"},
+    {"STH",     OP_STH,         "rri"},
+    {"STW",     OP_STW,         "rri"},
+    {"STQ",     OP_STQ,         "rri"},
 
-    {"PRT",     OP_PRINT,       1},
+    {"SLT",     OP_SLT,         "rrr"},
+    {"SLTU",    OP_SLTU,        "rrr"},
+    {"SLE",     OP_SLE,         "rrr"},
+    {"SLEU",    OP_SLEU,        "rrr"},
+    {"SEL",     OP_SEL,         "rrr"},
 
-    {NULL, 0, 0}  // End
+    {"BEQ",     OP_BEQ,         "rrr"},
+    {"BNE",     OP_BNE,         "rrr"},
+    {"BLT",     OP_BLT,         "rrr"},
+    {"BLTU",    OP_BLTU,        "rrr"},
+
+    {"FADDD",   OP_FADDD,       "rrr"},
+    {"FSUBD",   OP_FSUBD,       "rrr"},
+    {"FMULD",   OP_FMULD,       "rrr"},
+    {"FDIVD",   OP_FDIVD,       "rrr"},
+    {"FMAD",    OP_FMAD,        "rrr"},
+    {"FSQRTD",  OP_FSQRTD,      "rr"},
+    {"FEQD",    OP_FEQD,        "rrr"},
+    {"FLTD",    OP_FLTD,        "rrr"},
+    {"FLED",    OP_FLED,        "rrr"},
+    {"ITOF",    OP_ITOF,        "rr"},
+    {"FTOI",    OP_FTOI,        "rr"},
+
+    {NULL, 0, NULL}  // End
 };
 
+/* Pseudo opcode of a label definition in the parsed program */
+#define ASM_LABEL -1
+
+#define MAX_OPERANDS 3
+#define MAX_LABELS 1024
+#define NAME_LENGTH 32
+
+/* Parsed instruction */
+typedef struct {
+    int opcode;                 // Opcode, ASM_LABEL for a label definition
+    int regs[MAX_OPERANDS];     // Register operands
+    uint64_t imm;               // Immediate operand
+    int label;                  // Label used as immediate or defined, -1 if none
+    int line_num;
+    uint64_t trap_reads;        // Registers read by a TRAP of known number, 0 if unknown
+} asm_insn;
+
+/* Parsed program */
+typedef struct {
+    asm_insn* insns;
+    int count;
+    int capacity;
+
+    char labels[MAX_LABELS][NAME_LENGTH];
+    size_t label_address[MAX_LABELS];
+    int label_defined[MAX_LABELS];
+    int num_labels;
+} asm_program;
+
 /* Switch all characters to uppercase */
 void to_upper(char* str) {
     for (int i = 0; str[i]; i++) {
@@ -102,8 +238,8 @@ void to_upper(char* str) {
 
 /* Get register name */
 int parse_register(char* reg) {
-    if (reg[0] == 'R' && isdigit(reg[1]) && reg[2] == '\0') {
-        int reg_num = reg[1] - '0';
+    if (reg[0] == 'R' && isdigit(reg[1]) && (reg[2] == '\0' || (reg[1] != '0' && isdigit(reg[2]) && reg[3] == '\0'))) {
+        int reg_num = atoi(reg + 1);
         if (reg_num >= 0 && reg_num < NUM_REGISTERS) {
             return reg_num;
         }
@@ -111,267 +247,1048 @@ int parse_register(char* reg) {
     return -1;  // Invaild register
 }
 
-/* Get number */
-int parse_number(char* num_str) {
+/* Get number, returns 0 if the string is not a number */
+int parse_number(char* num_str, uint64_t* value) {
+    char* end = NULL;
+
+    if (!isdigit((unsigned char)num_str[0]) &&
+        !(num_str[0] == '-' && isdigit((unsigned char)num_str[1]))) {
+        return 0;
+    }
+
     /* Check if HEX */
     if (num_str[0] == '0' && (num_str[1] == 'x' || num_str[1] == 'X')) {
-        return (int)strtol(num_str, NULL, 16);
+        *value = strtoull(num_str, &end, 16);
+    } else if (strpbrk(num_str, ".E")) {
+        /* Float literal, stored as its binary64 bits */
+        double number = strtod(num_str, &end);
+        memcpy(value, &number, sizeof(*value));
+    } else {
+        *value = (uint64_t)strtoll(num_str, &end, 10);
     }
-    return atoi(num_str);
+
+    return *end == '\0';
 }
 
-/* Assembly */
-int assemble(char* input_filename, char* output_filename) {
-    FILE* input_file = fopen(input_filename, "r");
-    FILE* output_file = fopen(output_filename, "wb");
-    
-    if (!input_file || !output_file) {
-        printf("Could not open file\n");
-        return 1;
+/* Check label name */
+int is_label_name(char* name) {
+    if (!isalpha((unsigned char)name[0]) && name[0] != '_' && name[0] != '.') {
+        return 0;
     }
-    
+
+    for (int i = 1; name[i]; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_' && name[i] != '.') {
+            return 0;
+        }
+    }
+
+    return strlen(name) < NAME_LENGTH && parse_register(name) == -1;
+}
+
+/* Find label by name, create it when missing */
+int find_label(asm_program* prog, char* name) {
+    for (int i = 0; i < prog->num_labels; i++) {
+        if (strcmp(prog->labels[i], name) == 0) {
+            return i;
+        }
+    }
+
+    if (prog->num_labels >= MAX_LABELS) {
+        return -1;
+    }
+
+    strcpy(prog->labels[prog->num_labels], name);
+    prog->label_defined[prog->num_labels] = 0;
+
+    return prog->num_labels++;
+}
+
+/* Find instruction by mnemonic or opcode */
+instruction_info* find_instruction(char* mnemonic, int opcode) {
+    for (int i = 0; instruction_table[i].mnemonic != NULL; i++) {
+        if (mnemonic ? strcmp(mnemonic, instruction_table[i].mnemonic) == 0
+                     : opcode == instruction_table[i].opcode) {
+            return &instruction_table[i];
+        }
+    }
+    return NULL;
+}
+
+/* Get encoded size of an instruction */
+size_t instruction_size(int opcode) {
+    if (opcode == ASM_LABEL) {
+        return 0;
+    }
+
+    size_t size = 1;
+    for (char* p = find_instruction(NULL, opcode)->operands; *p; p++) {
+        size += (*p == 'i') ? 8 : 1;
+    }
+    return size;
+}
+
+void program_append(asm_program* prog, asm_insn* insn) {
+    if (prog->count == prog->capacity) {
+        prog->capacity = prog->capacity ? prog->capacity * 2 : 64;
+        prog->insns = realloc(prog->insns, sizeof(asm_insn) * prog->capacity);
+        if (!prog->insns) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+    }
+    prog->insns[prog->count++] = *insn;
+}
+
+/* Parse source file into a program, returns number of errors */
+int parse(FILE* input_file, asm_program* prog) {
     char line[256];
     int line_num = 0;
-    
+    int errors = 0;
+
     while (fgets(line, sizeof(line), input_file)) {
         line_num++;
-        
-        /* Remove newline */
-        line[strcspn(line, "\n")] = 0;
-        
-        /* Skip empty lines and comments */
-        if (line[0] == ';' || line[0] == '#' || line[0] == '\0') {
-            continue;
-        }
-        
+
+        /* Remove newline and comments */
+        line[strcspn(line, "\r\n;#")] = 0;
+
         /* Switch the characters to uppercase */
         to_upper(line);
-        
-        char opcode_str[32];
-        char operands[3][32];
 
-        /* Get instruction */
-        int tokens = sscanf(line, "%31s %31s %31s %31s", 
-                           opcode_str, operands[0], operands[1], operands[2]);
-        
-        if (tokens < 1) {
-            printf("Line %d: Invalid instruction\n", line_num);
+        char tokens[1 + MAX_OPERANDS + 1][NAME_LENGTH];
+        int num_tokens = 0;
+
+        for (char* tok = strtok(line, " \t,"); tok; tok = strtok(NULL, " \t,")) {
+            if (num_tokens == 1 + MAX_OPERANDS + 1) {
+                break;
+            }
+            snprintf(tokens[num_tokens++], NAME_LENGTH, "%s", tok);
+        }
+
+        /* Skip empty lines */
+        if (num_tokens == 0) {
             continue;
         }
-        
-        /* Find instruction */
-        instruction_info* instr = NULL;
-        for (int i = 0; instruction_table[i].mnemonic != NULL; i++) {
-            if (strcmp(opcode_str, instruction_table[i].mnemonic) == 0) {
-                instr = &instruction_table[i];
-                break;
+
+        int first = 0;
+
+        /* Label definition */
+        size_t len = strlen(tokens[0]);
+        if (tokens[0][len - 1] == ':') {
+            tokens[0][len - 1] = '\0';
+
+            int label = is_label_name(tokens[0]) ? find_label(prog, tokens[0]) : -1;
+            if (label == -1 || prog->label_defined[label]) {
+                printf("Line %d: Invalid or duplicate label '%s'\n", line_num, tokens[0]);
+                errors++;
+                continue;
+            }
+            prog->label_defined[label] = 1;
+
+            asm_insn def = { .opcode = ASM_LABEL, .label = label, .line_num = line_num };
+            program_append(prog, &def);
+
+            first = 1;
+            if (num_tokens == 1) {
+                continue;
             }
         }
-        
+
+        /* Find instruction */
+        instruction_info* instr = find_instruction(tokens[first], 0);
+
         if (!instr) {
-            printf("Line %d: Unknown instruction '%s'\n", line_num, opcode_str);
+            printf("Line %d: Unknown instruction '%s'\n", line_num, tokens[first]);
+            errors++;
             continue;
         }
-        
+
         /* Check operand amount */
-        if (tokens - 1 != instr->num_operands) {
-            printf("Line %d: Instruction '%s' needs %d operands, got %d\n", 
-                  line_num, instr->mnemonic, instr->num_operands, tokens - 1);
+        int num_operands = (int)strlen(instr->operands);
+        if (num_tokens - first - 1 != num_operands) {
+            printf("Line %d: Instruction '%s' needs %d operands, got %d\n",
+                  line_num, instr->mnemonic, num_operands, num_tokens - first - 1);
+            errors++;
             continue;
         }
-        
-        /* Write opcode */
-        fputc(instr->opcode, output_file);
-        
+
+        asm_insn insn = { .opcode = instr->opcode, .label = -1, .line_num = line_num };
+        int reg_index = 0;
+
         /* Process operand */
-        for (int i = 0; i < instr->num_operands; i++) {
-            if (strncmp(operands[i], "R", 1) == 0) {
+        for (int i = 0; i < num_operands; i++) {
+            char* operand = tokens[first + 1 + i];
+
+            if (instr->operands[i] == 'r') {
                 /* Register operand */
-                int reg = parse_register(operands[i]);
+                int reg = parse_register(operand);
                 if (reg == -1) {
-                    printf("Line %d: Invalid register '%s'\n", line_num, operands[i]);
-                    fclose(input_file);
-                    fclose(output_file);
-                    return 1;
+                    printf("Line %d: Invalid register '%s'\n", line_num, operand);
+                    errors++;
                 }
-                fputc(reg, output_file);
-            } else {
-                /* Immediate operand */
-                size_t num = parse_number(operands[i]);
-
-                if ((instr->opcode == OP_LOAD || instr->opcode == OP_LA || instr->opcode == OP_SA) && i == 1) {
-                    /* Write 8 bytes address (Little endian) */
-                    for (int j = 0; j < 8; j++) {
-                        fputc((num >> (j * 8)) & 0xFF, output_file);
-                    }
-                } else {
-                    // 其他立即数只写入1字节
-                    fputc(num & 0xFF, output_file);
+                insn.regs[reg_index++] = reg;
+            } else if (!parse_number(operand, &insn.imm)) {
+                /* Label operand */
+                insn.label = is_label_name(operand) ? find_label(prog, operand) : -1;
+                if (insn.label == -1) {
+                    printf("Line %d: Invalid operand '%s'\n", line_num, operand);
+                    errors++;
                 }
             }
         }
+
+        program_append(prog, &insn);
     }
-    
-    fclose(input_file);
-    fclose(output_file);
-    return 0;
+
+    for (int i = 0; i < prog->num_labels; i++) {
+        if (!prog->label_defined[i]) {
+            printf("Undefined label '%s'\n", prog->labels[i]);
+            errors++;
+        }
+    }
+
+    return errors;
 }
 
-/* Disassembly for verification */
-void disassemble(char* filename) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        printf("Could not open file\n");
-        return;
+/* Opcode classes used by the optimizer */
+int is_branch(int opcode) {
+    return opcode == OP_JUMP || opcode == OP_JNZ || opcode == OP_JZ || opcode == OP_LOOP ||
+           opcode == OP_BEQ || opcode == OP_BNE || opcode == OP_BLT || opcode == OP_BLTU ||
+           opcode == OP_CALL || opcode == OP_SPAWN;    // A spawned thread starts at the target
+}
+
+int ends_block(int opcode) {
+    return opcode == OP_HALT || opcode == OP_RET || is_branch(opcode);
+}
+
+int falls_through(int opcode) {
+    return opcode != OP_HALT && opcode != OP_JUMP && opcode != OP_RET;
+}
+
+/* Register holding the target of a branch */
+int branch_target_reg(asm_insn* insn) {
+    switch (insn->opcode) {
+        case OP_JUMP: case OP_CALL:
+            return insn->regs[0];
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLTU:
+            return insn->regs[2];
+        default:
+            return insn->regs[1];
     }
-    
-    int opcode;
-    while ((opcode = fgetc(file)) != EOF) {
-        /* Find instruction */
-        instruction_info* instr = NULL;
-        for (int i = 0; instruction_table[i].mnemonic != NULL; i++) {
-            if (opcode == instruction_table[i].opcode) {
-                instr = &instruction_table[i];
-                break;
-            }
+}
+
+/* Argument registers a trap reads, starting at its value register */
+int trap_args(uint64_t number) {
+    switch (number) {
+        case TRAP_GETC: case TRAP_CLOCK:
+            return 0;
+        case TRAP_SEND: case TRAP_RECV: case TRAP_READ: case TRAP_WRITE: case TRAP_WRITEV:
+            return 3;
+        case TRAP_MMAP:
+            return 5;
+        case TRAP_PUTC: case TRAP_SNAPSHOT: case TRAP_CLOSE: case TRAP_MUNMAP:
+        case TRAP_COUNTER: case TRAP_PUTF:
+            return 1;
+        default:
+            return TRAP_MAX_ARGS;
+    }
+}
+
+/* Registers read by a trap taking count arguments from reg on, wrapping like TRAP_ARG */
+uint64_t trap_window(int number_reg, int reg, int count) {
+    uint64_t mask = 1ULL << number_reg;
+    for (int i = 0; i < count; i++) {
+        mask |= 1ULL << ((reg + i) & (NUM_REGISTERS - 1));
+    }
+    return mask;
+}
+
+/* Bitmask of registers read by an instruction */
+uint64_t regs_read(asm_insn* insn) {
+    switch (insn->opcode) {
+        case OP_SA: case OP_INCREASE: case OP_DECREASE: case OP_NOT:
+        case OP_JUMP: case OP_PRINT: case OP_PUSH:
+            return 1ULL << insn->regs[0];
+        case OP_MOV: case OP_FSQRTD: case OP_ITOF: case OP_FTOI:
+            return 1ULL << insn->regs[1];
+        case OP_ADD: case OP_SUB: case OP_MULTI: case OP_DIVIDE:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_CMP:
+        case OP_SLT: case OP_SLTU: case OP_SLE: case OP_SLEU:
+        case OP_FADDD: case OP_FSUBD: case OP_FMULD: case OP_FDIVD:
+        case OP_FEQD: case OP_FLTD: case OP_FLED:
+            return (1ULL << insn->regs[1]) | (1ULL << insn->regs[2]);
+        case OP_JNZ: case OP_JZ: case OP_LOOP:
+            return (1ULL << insn->regs[0]) | (1ULL << insn->regs[1]);
+        case OP_HALT:
+            return 1ULL << 0;   // R0 is the result of a thread, see JOIN
+        case OP_JOIN:
+            return 1ULL << insn->regs[1];
+        case OP_FADD: case OP_XCHG:
+            return (1ULL << insn->regs[1]) | (1ULL << insn->regs[2]);
+        case OP_LDB: case OP_LDBS: case OP_LDH: case OP_LDHS:
+        case OP_LDW: case OP_LDWS: case OP_LDQ:
+            return 1ULL << insn->regs[1];
+        case OP_STB: case OP_STH: case OP_STW: case OP_STQ:
+            return (1ULL << insn->regs[0]) | (1ULL << insn->regs[1]);
+        case OP_CAS: case OP_SEL: case OP_FMAD:
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLTU:
+            return (1ULL << insn->regs[0]) | (1ULL << insn->regs[1]) | (1ULL << insn->regs[2]);
+        case OP_TRAP:
+            return insn->trap_reads ? insn->trap_reads : trap_window(insn->regs[0], insn->regs[1], TRAP_MAX_ARGS);
+        case OP_CALL: case OP_SPAWN:
+            return (1ULL << NUM_REGISTERS) - 1;   // Subroutines and threads may read any register
+        default:
+            return 0;
+    }
+}
+
+/* Register always written by an instruction, -1 if none */
+int reg_written(asm_insn* insn) {
+    switch (insn->opcode) {
+        case OP_LOAD: case OP_LA: case OP_MOV:
+        case OP_ADD: case OP_SUB: case OP_MULTI: case OP_DIVIDE:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_CMP:
+        case OP_SLT: case OP_SLTU: case OP_SLE: case OP_SLEU: case OP_SEL:
+        case OP_FADDD: case OP_FSUBD: case OP_FMULD: case OP_FDIVD: case OP_FMAD:
+        case OP_FSQRTD: case OP_FEQD: case OP_FLTD: case OP_FLED: case OP_ITOF: case OP_FTOI:
+        case OP_INCREASE: case OP_DECREASE: case OP_NOT: case OP_LOOP:
+        case OP_POP: case OP_SPAWN: case OP_JOIN:
+        case OP_CAS: case OP_FADD: case OP_XCHG:
+        case OP_LDB: case OP_LDBS: case OP_LDH: case OP_LDHS:
+        case OP_LDW: case OP_LDWS: case OP_LDQ:
+            return insn->regs[0];
+        default:
+            return -1;
+    }
+}
+
+/* Instruction can be removed when its result is unused */
+int is_pure(asm_insn* insn) {
+    switch (insn->opcode) {
+        case OP_LOAD: case OP_LA: case OP_MOV:
+        case OP_ADD: case OP_SUB: case OP_MULTI:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_CMP:
+        case OP_SLT: case OP_SLTU: case OP_SLE: case OP_SLEU: case OP_SEL:
+        case OP_FADDD: case OP_FSUBD: case OP_FMULD: case OP_FDIVD: case OP_FMAD:
+        case OP_FSQRTD: case OP_FEQD: case OP_FLTD: case OP_FLED: case OP_ITOF: case OP_FTOI:
+        case OP_INCREASE: case OP_DECREASE: case OP_NOT:
+            return 1;
+        default:
+            return 0;   // DIV may fault on zero, sized loads out of memory
+    }
+}
+
+/* Known content of a register during propagation */
+typedef struct {
+    int kind;           // VALUE_UNKNOWN, VALUE_CONST or VALUE_COPY
+    uint64_t imm;       // Constant value
+    int label;          // Constant label, -1 if plain number
+    int reg;            // Source register of a copy
+} reg_value;
+
+enum { VALUE_UNKNOWN = 0, VALUE_CONST, VALUE_COPY };
+
+/* Forget a register and every copy of it */
+void value_kill(reg_value* values, int reg) {
+    values[reg].kind = VALUE_UNKNOWN;
+    for (int i = 0; i < NUM_REGISTERS; i++) {
+        if (values[i].kind == VALUE_COPY && values[i].reg == reg) {
+            values[i].kind = VALUE_UNKNOWN;
         }
-        
-        if (!instr) {
-            printf("Unknown opcode: %02X\n", opcode);
-            break;
+    }
+}
+
+int value_is_const(reg_value* values, int reg, uint64_t imm, int label) {
+    return values[reg].kind == VALUE_CONST && values[reg].imm == imm && values[reg].label == label;
+}
+
+/* Fold a binary operation, returns 0 if it can not be folded */
+int fold(int opcode, uint64_t a, uint64_t b, uint64_t* result) {
+    switch (opcode) {
+        case OP_ADD:    *result = a + b; return 1;
+        case OP_SUB:    *result = a - b; return 1;
+        case OP_MULTI:  *result = a * b; return 1;
+        case OP_DIVIDE: if (b == 0) return 0; *result = a / b; return 1;
+        case OP_AND:    *result = a & b; return 1;
+        case OP_OR:     *result = a | b; return 1;
+        case OP_XOR:    *result = a ^ b; return 1;
+        case OP_CMP:    *result = (a == b); return 1;
+        case OP_SLT:    *result = ((int64_t)a < (int64_t)b); return 1;
+        case OP_SLTU:   *result = (a < b); return 1;
+        case OP_SLE:    *result = ((int64_t)a <= (int64_t)b); return 1;
+        case OP_SLEU:   *result = (a <= b); return 1;
+        default:        return 0;
+    }
+}
+
+/* Remove instructions marked with ASM_DELETED */
+#define ASM_DELETED -2
+
+void program_compact(asm_program* prog) {
+    int n = 0;
+    for (int i = 0; i < prog->count; i++) {
+        if (prog->insns[i].opcode != ASM_DELETED) {
+            prog->insns[n++] = prog->insns[i];
         }
-        
-        printf("%s", instr->mnemonic);
-        
-        /* Read and print operand */
-        for (int i = 0; i < instr->num_operands; i++) {
-            int operand = fgetc(file);
-            if (operand == EOF) {
-                printf(" Unexpected EOF\n");
-                fclose(file);
-                return;
+    }
+    prog->count = n;
+}
+
+/* Constant and copy propagation with folding inside basic blocks */
+int propagate(asm_program* prog) {
+    reg_value values[NUM_REGISTERS];
+    int changed = 0;
+
+    memset(values, 0, sizeof(values));
+
+    for (int i = 0; i < prog->count; i++) {
+        asm_insn* insn = &prog->insns[i];
+
+        if (insn->opcode == ASM_LABEL) {
+            memset(values, 0, sizeof(values));
+            continue;
+        }
+
+        /* Read through copies */
+        int first_src = -1, last_src = -1;
+        if (insn->opcode == OP_MOV) {
+            first_src = last_src = 1;
+        } else if ((insn->opcode >= OP_ADD && insn->opcode <= OP_CMP &&
+                    insn->opcode != OP_INCREASE && insn->opcode != OP_DECREASE && insn->opcode != OP_NOT) ||
+                   (insn->opcode >= OP_SLT && insn->opcode <= OP_SLEU)) {
+            first_src = 1;
+            last_src = 2;
+        }
+        for (int k = first_src; k != -1 && k <= last_src; k++) {
+            if (values[insn->regs[k]].kind == VALUE_COPY) {
+                insn->regs[k] = values[insn->regs[k]].reg;
+                changed = 1;
             }
-            
-            /* Format output by instruction type */
-            switch (instr->opcode) {
-                case OP_LOAD:
-                case OP_LA: 
-                case OP_SA: {
-                    if (i == 0) {
-                        printf(" R%d", operand);
-                    } else {
-                        size_t addr = (size_t)operand;
-                        for (int j = 1; j < 8; j++) {
-                            int next_byte = fgetc(file);
-                            if (next_byte == EOF) {
-                                printf(" Unexpected EOF\n");
-                                fclose(file);
-                                return;
-                            }
-                            addr |= (size_t)next_byte << (j * 8);
-                        }
-                        printf(" 0x%lx", addr);
-                    }
+        }
+
+        switch (insn->opcode) {
+            case OP_LOAD: {
+                int dest = insn->regs[0];
+                if (value_is_const(values, dest, insn->imm, insn->label)) {
+                    insn->opcode = ASM_DELETED;
+                    changed = 1;
                     break;
                 }
+                value_kill(values, dest);
+                values[dest] = (reg_value){ VALUE_CONST, insn->imm, insn->label, 0 };
+                break;
+            }
 
-                case OP_MOV: {
-                    printf(" R%d", operand);
+            case OP_MOV: {
+                int dest = insn->regs[0], src = insn->regs[1];
+                if (dest == src || (values[dest].kind == VALUE_COPY && values[dest].reg == src) ||
+                    (values[src].kind == VALUE_CONST &&
+                     value_is_const(values, dest, values[src].imm, values[src].label))) {
+                    insn->opcode = ASM_DELETED;
+                    changed = 1;
                     break;
                 }
-                
-                case OP_ADD: {
-                    if (i == 0) printf(" R%d", operand);
-                    else printf(" %d", operand);
-                    break;
+                reg_value value = values[src];
+                value_kill(values, dest);
+                if (value.kind == VALUE_CONST) {
+                    /* Load the constant, so the source may die */
+                    *insn = (asm_insn){ .opcode = OP_LOAD, .regs = { dest }, .imm = value.imm,
+                                        .label = value.label, .line_num = insn->line_num };
+                    values[dest] = value;
+                    changed = 1;
+                } else {
+                    values[dest] = (reg_value){ VALUE_COPY, 0, -1, src };
                 }
+                break;
+            }
 
-                case OP_SUB: {
-                    if (i == 0) printf(" R%d", operand);
-                    else printf(" %d", operand);
-                    break;
-                }
+            case OP_ADD: case OP_SUB: case OP_MULTI: case OP_DIVIDE:
+            case OP_AND: case OP_OR: case OP_XOR: case OP_CMP:
+            case OP_SLT: case OP_SLTU: case OP_SLE: case OP_SLEU: {
+                int dest = insn->regs[0];
+                reg_value a = values[insn->regs[1]], b = values[insn->regs[2]];
+                uint64_t result;
 
-                case OP_MULTI :{
-                    if (i == 0) printf(" R%d", operand);
-                    else printf(" %d", operand);
-                    break;
+                value_kill(values, dest);
+                if (a.kind == VALUE_CONST && a.label == -1 && b.kind == VALUE_CONST && b.label == -1 &&
+                    fold(insn->opcode, a.imm, b.imm, &result)) {
+                    *insn = (asm_insn){ .opcode = OP_LOAD, .regs = { dest }, .imm = result,
+                                        .label = -1, .line_num = insn->line_num };
+                    values[dest] = (reg_value){ VALUE_CONST, result, -1, 0 };
+                    changed = 1;
                 }
+                break;
+            }
 
-                case OP_DIVIDE: {
-                    if (i == 0) printf(" R%d", operand);
-                    else printf(" %d", operand);
-                    break;
-                }
+            case OP_INCREASE: case OP_DECREASE: case OP_NOT: {
+                int dest = insn->regs[0];
+                reg_value a = values[dest];
 
-                case OP_AND: {
-                    if (i == 0) printf(" R%d", operand);
-                    else printf(" %d", operand);
-                    break;
+                value_kill(values, dest);
+                if (a.kind == VALUE_CONST && a.label == -1) {
+                    uint64_t result = (insn->opcode == OP_INCREASE) ? a.imm + 1 :
+                                      (insn->opcode == OP_DECREASE) ? a.imm - 1 : !a.imm;
+                    *insn = (asm_insn){ .opcode = OP_LOAD, .regs = { dest }, .imm = result,
+                                        .label = -1, .line_num = insn->line_num };
+                    values[dest] = (reg_value){ VALUE_CONST, result, -1, 0 };
+                    changed = 1;
                 }
+                break;
+            }
 
-                case OP_NOT: {
-                    printf(" R%d", operand);
-                    break;
+            /* A trap only writes its value register */
+            case OP_TRAP: {
+                reg_value number = values[insn->regs[0]];
+                if (number.kind == VALUE_CONST && number.label == -1) {
+                    insn->trap_reads = trap_window(insn->regs[0], insn->regs[1], trap_args(number.imm));
                 }
+                value_kill(values, insn->regs[1]);
+                break;
+            }
 
-                case OP_OR: {
-                    if (i == 0) printf(" R%d", operand);
-                    else printf(" %d", operand);
-                    break;
+            default: {
+                int dest = reg_written(insn);
+                if (dest != -1) {
+                    value_kill(values, dest);
                 }
+                break;
+            }
+        }
 
-                case OP_XOR: {
-                    if (i == 0) printf(" R%d", operand);
-                    else printf(" %d", operand);
-                    break;
-                }
+        if (ends_block(insn->opcode)) {
+            memset(values, 0, sizeof(values));
+        }
+    }
 
-                case OP_CMP: {
-                    if (i == 0) printf(" R%d", operand);
-                    else printf(" %d", operand);
-                    break;
-                }
+    program_compact(prog);
+    return changed;
+}
 
-                case OP_INCREASE: {
-                    printf(" R%d", operand);
-                    break;
-                }
+/* Cancel INC/DEC pairs on a register which is not used in between */
+int peephole(asm_program* prog) {
+    int changed = 0;
 
-                case OP_DECREASE: {
-                    printf(" R%d", operand);
-                    break;
-                }
+    for (int i = 0; i < prog->count; i++) {
+        int op = prog->insns[i].opcode;
+        if (op != OP_INCREASE && op != OP_DECREASE) {
+            continue;
+        }
 
-                case OP_JUMP: {
-                    printf(" R%d", operand);
-                    break;
-                }
+        int reg = prog->insns[i].regs[0];
+        int inverse = (op == OP_INCREASE) ? OP_DECREASE : OP_INCREASE;
 
-                case OP_JNZ: {
-                    printf(" R%d", operand);
-                    break;
+        for (int j = i + 1; j < prog->count; j++) {
+            asm_insn* next = &prog->insns[j];
+
+            if (next->opcode == ASM_DELETED) {
+                continue;
+            }
+            if (next->opcode == inverse && next->regs[0] == reg) {
+                prog->insns[i].opcode = ASM_DELETED;
+                next->opcode = ASM_DELETED;
+                changed = 1;
+                break;
+            }
+            if (next->opcode == ASM_LABEL || ends_block(next->opcode) ||
+                (regs_read(next) & (1ULL << reg)) || reg_written(next) == reg) {
+                break;
+            }
+        }
+    }
+
+    program_compact(prog);
+    return changed;
+}
+
+/* Basic block of the program */
+typedef struct {
+    int start, end;             // Instruction range
+    int succ_fall;              // Fall through successor, -1 if none
+    int succ_target;            // Known branch target, -1 if none
+    int succ_unknown;           // Branch target unknown
+    uint64_t live_in;
+    int reachable;
+} asm_block;
+
+/* Label loaded into the target register of the branch ending a block, -1 if unknown */
+int block_branch_label(asm_program* prog, asm_block* block) {
+    asm_insn* last = &prog->insns[block->end - 1];
+    int reg = branch_target_reg(last);
+
+    for (int i = block->end - 2; i >= block->start; i--) {
+        asm_insn* insn = &prog->insns[i];
+        if (reg_written(insn) == reg || insn->opcode == OP_TRAP) {
+            return (insn->opcode == OP_LOAD) ? insn->label : -1;
+        }
+    }
+    return -1;
+}
+
+/* Number of a block starting with a label */
+int label_block(asm_block* blocks, int num_blocks, asm_program* prog, int label) {
+    for (int b = 0; b < num_blocks; b++) {
+        for (int i = blocks[b].start; i < blocks[b].end && prog->insns[i].opcode == ASM_LABEL; i++) {
+            if (prog->insns[i].label == label) {
+                return b;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Split program into basic blocks, returns number of blocks */
+int build_blocks(asm_program* prog, asm_block** out) {
+    asm_block* blocks = calloc(prog->count + 1, sizeof(asm_block));
+    int n = 0;
+
+    for (int i = 0; i < prog->count; ) {
+        int start = i;
+
+        /* Labels only start a block */
+        while (i < prog->count && prog->insns[i].opcode == ASM_LABEL) i++;
+        while (i < prog->count && prog->insns[i].opcode != ASM_LABEL) {
+            if (ends_block(prog->insns[i++].opcode)) break;
+        }
+
+        blocks[n++] = (asm_block){ start, i, -1, -1, 0, 0, 0 };
+    }
+
+    for (int b = 0; b < n; b++) {
+        asm_block* block = &blocks[b];
+        int last = (block->end > block->start) ? prog->insns[block->end - 1].opcode : ASM_LABEL;
+
+        if (falls_through(last) && b + 1 < n) {
+            block->succ_fall = b + 1;
+        }
+        if (is_branch(last)) {
+            int label = block_branch_label(prog, block);
+            block->succ_target = (label == -1) ? -1 : label_block(blocks, n, prog, label);
+            block->succ_unknown = (block->succ_target == -1);
+        }
+        if (last == OP_RET) {
+            block->succ_unknown = 1;
+        }
+    }
+
+    *out = blocks;
+    return n;
+}
+
+/* Labels loaded by any instruction may be jumped to through an unknown target */
+int label_referenced(asm_program* prog, int label) {
+    for (int i = 0; i < prog->count; i++) {
+        if (prog->insns[i].opcode != ASM_LABEL && prog->insns[i].label == label) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Blocks a jump with unknown target can reach */
+int block_address_taken(asm_block* block, asm_program* prog) {
+    for (int i = block->start; i < block->end && prog->insns[i].opcode == ASM_LABEL; i++) {
+        if (label_referenced(prog, prog->insns[i].label)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Remove unreachable blocks and instructions writing dead registers */
+int eliminate(asm_program* prog) {
+    asm_block* blocks;
+    int n = build_blocks(prog, &blocks);
+    int changed = 0;
+
+    int* taken = calloc(n + 1, sizeof(int));
+    int any_unknown = 0;
+    for (int b = 0; b < n; b++) {
+        /* Return sites are reached by RET */
+        taken[b] = block_address_taken(&blocks[b], prog) ||
+                   (b > 0 && prog->insns[blocks[b - 1].end - 1].opcode == OP_CALL);
+    }
+
+    /* Reachability */
+    int* stack = calloc(n + 1, sizeof(int));
+    int sp = 0;
+    if (n > 0) {
+        blocks[0].reachable = 1;
+        stack[sp++] = 0;
+    }
+    while (sp > 0) {
+        asm_block* block = &blocks[stack[--sp]];
+        int succ[2] = { block->succ_fall, block->succ_target };
+
+        for (int k = 0; k < 2; k++) {
+            if (succ[k] != -1 && !blocks[succ[k]].reachable) {
+                blocks[succ[k]].reachable = 1;
+                stack[sp++] = succ[k];
+            }
+        }
+        if (block->succ_unknown && !any_unknown) {
+            any_unknown = 1;
+            for (int b = 0; b < n; b++) {
+                if (taken[b] && !blocks[b].reachable) {
+                    blocks[b].reachable = 1;
+                    stack[sp++] = b;
                 }
+            }
+        }
+    }
 
-                case OP_JZ: {
-                    printf(" R%d", operand);
-                    break;
+    for (int b = 0; b < n; b++) {
+        if (blocks[b].reachable) continue;
+        for (int i = blocks[b].start; i < blocks[b].end; i++) {
+            if (prog->insns[i].opcode != ASM_LABEL) {
+                prog->insns[i].opcode = ASM_DELETED;
+                changed = 1;
+            }
+        }
+    }
+
+    /* Liveness, iterated to a fixed point */
+    uint64_t unknown_live = 0;
+    int again = 1;
+    while (again) {
+        again = 0;
+        for (int b = n - 1; b >= 0; b--) {
+            asm_block* block = &blocks[b];
+            uint64_t live = 0;
+
+            if (block->succ_fall != -1) live |= blocks[block->succ_fall].live_in;
+            if (block->succ_target != -1) live |= blocks[block->succ_target].live_in;
+            if (block->succ_unknown) live |= unknown_live;
+            if (b == n - 1) live |= 1ULL << 0;      // Falling off the end stops like HLT
+
+            for (int i = block->end - 1; i >= block->start; i--) {
+                asm_insn* insn = &prog->insns[i];
+                if (insn->opcode < 0) continue;
+
+                int dest = reg_written(insn);
+                if (dest != -1 && insn->opcode != OP_LOOP && insn->opcode != OP_INCREASE &&
+                    insn->opcode != OP_DECREASE && insn->opcode != OP_NOT) {
+                    live &= ~(1ULL << dest);
                 }
+                live |= regs_read(insn);
+            }
 
-                case OP_LOOP: {
-                    printf(" R%d", operand);
-                    break;
+            if (live != block->live_in) {
+                block->live_in = live;
+                again = 1;
+            }
+            if (taken[b] && (unknown_live | live) != unknown_live) {
+                unknown_live |= live;
+                again = 1;
+            }
+        }
+    }
+
+    /* Dead writes */
+    for (int b = 0; b < n; b++) {
+        asm_block* block = &blocks[b];
+        uint64_t live = 0;
+
+        if (block->succ_fall != -1) live |= blocks[block->succ_fall].live_in;
+        if (block->succ_target != -1) live |= blocks[block->succ_target].live_in;
+        if (block->succ_unknown) live |= unknown_live;
+        if (b == n - 1) live |= 1ULL << 0;
+
+        for (int i = block->end - 1; i >= block->start; i--) {
+            asm_insn* insn = &prog->insns[i];
+            if (insn->opcode < 0) continue;
+
+            int dest = reg_written(insn);
+            if (dest != -1 && is_pure(insn) && !(live & (1ULL << dest))) {
+                insn->opcode = ASM_DELETED;
+                changed = 1;
+                continue;
+            }
+
+            if (dest != -1 && insn->opcode != OP_LOOP && insn->opcode != OP_INCREASE &&
+                insn->opcode != OP_DECREASE && insn->opcode != OP_NOT) {
+                live &= ~(1ULL << dest);
+            }
+            live |= regs_read(insn);
+        }
+    }
+
+    free(stack);
+    free(taken);
+    free(blocks);
+
+    program_compact(prog);
+    return changed;
+}
+
+/* Place blocks reached by an unconditional jump right after it, turning the jump into a fall through */
+int layout(asm_program* prog) {
+    asm_block* blocks;
+    int n = build_blocks(prog, &blocks);
+    int changed = 0;
+
+    /* Chains of blocks linked by fall through */
+    int* chain_of = calloc(n + 1, sizeof(int));
+    int* chain_start = calloc(n + 1, sizeof(int));
+    int num_chains = 0;
+    for (int b = 0; b < n; b++) {
+        if (b == 0 || blocks[b - 1].succ_fall != b) {
+            chain_start[num_chains++] = b;
+        }
+        chain_of[b] = num_chains - 1;
+    }
+    chain_start[num_chains] = n;
+
+    /* The chain falling off the end of the program must stay last */
+    int last_chain = -1;
+    if (n > 0) {
+        int last = (blocks[n - 1].end > blocks[n - 1].start) ? prog->insns[blocks[n - 1].end - 1].opcode : ASM_LABEL;
+        if (falls_through(last)) {
+            last_chain = num_chains - 1;
+        }
+    }
+
+    asm_insn* out = malloc(sizeof(asm_insn) * (prog->count + 1));
+    int* placed = calloc(num_chains + 1, sizeof(int));
+    int count = 0;
+    int next = 0;
+
+    while (1) {
+        /* Pick next chain in source order */
+        while (next < num_chains && (placed[next] || next == last_chain)) next++;
+        int c = next;
+        if (c == num_chains) {
+            if (last_chain == -1 || placed[last_chain]) break;
+            c = last_chain;
+        }
+
+        while (c != -1) {
+            placed[c] = 1;
+
+            int end_block = chain_start[c + 1] - 1;
+            for (int b = chain_start[c]; b <= end_block; b++) {
+                for (int i = blocks[b].start; i < blocks[b].end; i++) {
+                    out[count++] = prog->insns[i];
                 }
+            }
 
-                case OP_PRINT: {
-                    printf(" R%d", operand);
-                    break;
+            /* Follow an unconditional jump to the head of an unplaced chain */
+            asm_block* tail = &blocks[end_block];
+            int target = tail->succ_target;
+            c = -1;
+            if (tail->end > tail->start && prog->insns[tail->end - 1].opcode == OP_JUMP && target != -1 &&
+                chain_start[chain_of[target]] == target && !placed[chain_of[target]] &&
+                chain_of[target] != 0 && chain_of[target] != last_chain) {
+                count--;    // Drop the jump
+                c = chain_of[target];
+                changed = 1;
+            }
+        }
+    }
+
+    memcpy(prog->insns, out, sizeof(asm_insn) * count);
+    prog->count = count;
+
+    free(out);
+    free(placed);
+    free(chain_of);
+    free(chain_start);
+    free(blocks);
+
+    return changed;
+}
+
+/* Branch targets must be labels, numeric addresses are not relocated */
+int can_optimize(asm_program* prog) {
+    reg_value values[NUM_REGISTERS];
+    int has_branch = 0;
+
+    memset(values, 0, sizeof(values));
+
+    for (int i = 0; i < prog->count; i++) {
+        asm_insn* insn = &prog->insns[i];
+
+        if (insn->opcode == ASM_LABEL) {
+            memset(values, 0, sizeof(values));
+            continue;
+        }
+
+        if (is_branch(insn->opcode)) {
+            reg_value* target = &values[branch_target_reg(insn)];
+            if (target->kind == VALUE_CONST && target->label == -1) {
+                printf("Line %d: Numeric branch target, optimization disabled\n", insn->line_num);
+                return 0;
+            }
+            has_branch = 1;
+        }
+
+        int dest = reg_written(insn);
+        if (insn->opcode == OP_LOAD) {
+            values[dest] = (reg_value){ VALUE_CONST, insn->imm, insn->label, 0 };
+        } else if (insn->opcode == OP_TRAP) {
+            memset(values, 0, sizeof(values));
+        } else if (dest != -1) {
+            values[dest].kind = VALUE_UNKNOWN;
+        }
+    }
+
+    if (has_branch && prog->num_labels == 0) {
+        printf("Branches without labels, optimization disabled\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+void optimize(asm_program* prog) {
+    if (!can_optimize(prog)) {
+        return;
+    }
+
+    int before = 0;
+    for (int i = 0; i < prog->count; i++) {
+        if (prog->insns[i].opcode != ASM_LABEL) before++;
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = propagate(prog);
+        changed |= peephole(prog);
+        changed |= eliminate(prog);
+        changed |= layout(prog);
+    }
+
+    int after = 0;
+    for (int i = 0; i < prog->count; i++) {
+        if (prog->insns[i].opcode != ASM_LABEL) after++;
+    }
+
+    printf("Optimized: %d -> %d instructions\n", before, after);
+}
+
+/* Write program as byte code */
+void emit(asm_program* prog, FILE* output_file) {
+    /* Header with the ISA version, addresses start after it */
+    fwrite(BYTECODE_MAGIC, 1, 4, output_file);
+    for (int i = 0; i < 4; i++) {
+        fputc((BYTECODE_VERSION >> (i * 8)) & 0xFF, output_file);
+    }
+
+    /* Resolve label addresses */
+    size_t address = 0;
+    for (int i = 0; i < prog->count; i++) {
+        if (prog->insns[i].opcode == ASM_LABEL) {
+            prog->label_address[prog->insns[i].label] = address;
+        }
+        address += instruction_size(prog->insns[i].opcode);
+    }
+
+    for (int i = 0; i < prog->count; i++) {
+        asm_insn* insn = &prog->insns[i];
+        if (insn->opcode == ASM_LABEL) {
+            continue;
+        }
+
+        /* Write opcode */
+        fputc(insn->opcode, output_file);
+
+        int reg_index = 0;
+        for (char* p = find_instruction(NULL, insn->opcode)->operands; *p; p++) {
+            if (*p == 'r') {
+                fputc(insn->regs[reg_index++], output_file);
+            } else {
+                uint64_t num = (insn->label == -1) ? insn->imm : prog->label_address[insn->label];
+
+                /* Write 8 bytes (Little endian) */
+                for (int j = 0; j < 8; j++) {
+                    fputc((num >> (j * 8)) & 0xFF, output_file);
                 }
+            }
+        }
+    }
+}
 
-                default: {
-                    printf(" %#x", operand);
-                    break;
+/* Assembly */
+int assemble(char* input_filename, char* output_filename, int optimize_level) {
+    FILE* input_file = fopen(input_filename, "r");
+
+    if (!input_file) {
+        printf("Could not open file\n");
+        return 1;
+    }
+
+    asm_program prog;
+    memset(&prog, 0, sizeof(prog));
+
+    int errors = parse(input_file, &prog);
+    fclose(input_file);
+
+    if (errors) {
+        free(prog.insns);
+        return 1;
+    }
+
+    if (optimize_level > 0) {
+        optimize(&prog);
+    }
+
+    FILE* output_file = fopen(output_filename, "wb");
+    if (!output_file) {
+        printf("Could not open file\n");
+        free(prog.insns);
+        return 1;
+    }
+
+    emit(&prog, output_file);
+
+    fclose(output_file);
+    free(prog.insns);
+    return 0;
+}
+
+/* Disassembly for verification */
+void disassemble(char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        printf("Could not open file\n");
+        return;
+    }
+    
+    /* Skip the header */
+    char magic[4];
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, BYTECODE_MAGIC, 4) != 0 || fseek(file, 4, SEEK_CUR) != 0) {
+        rewind(file);
+    }
+
+    int opcode;
+    while ((opcode = fgetc(file)) != EOF) {
+        /* Find instruction */
+        instruction_info* instr = find_instruction(NULL, opcode);
+        
+        if (!instr) {
+            printf("Unknown opcode: %02X\n", opcode);
+            break;
+        }
+        
+        printf("%s", instr->mnemonic);
+        
+        /* Read and print operand */
+        for (char* p = instr->operands; *p; p++) {
+            int size = (*p == 'i') ? 8 : 1;
+            uint64_t value = 0;
+
+            for (int j = 0; j < size; j++) {
+                int next_byte = fgetc(file);
+                if (next_byte == EOF) {
+                    printf(" Unexpected EOF\n");
+                    fclose(file);
+                    return;
                 }
+                value |= (uint64_t)next_byte << (j * 8);
+            }
+
+            if (*p == 'r') {
+                printf(" R%d", (int)value);
+            } else {
+                printf(" 0x%llx", (unsigned long long)value);
             }
         }
         printf("\n");
@@ -381,16 +1298,24 @@ void disassemble(char* filename) {
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        printf("Usage: %s <INPUT> <OUTPUT>\n", argv[0]);
-        printf("Example: %s program.asm program.bin\n", argv[0]);
+    int optimize_level = 0;
+    int arg = 1;
+
+    if (argc == 4 && strcmp(argv[1], "-O") == 0) {
+        optimize_level = 1;
+        arg = 2;
+    }
+
+    if (argc - arg != 2) {
+        printf("Usage: %s [-O] <INPUT> <OUTPUT>\n", argv[0]);
+        printf("Example: %s -O program.asm program.bin\n", argv[0]);
         return 1;
     }
     
-    if (assemble(argv[1], argv[2]) == 0) {
+    if (assemble(argv[arg], argv[arg + 1], optimize_level) == 0) {
         printf("Assembled successfully!\n");
         printf("Generated bytecode:\n");
-        disassemble(argv[2]);
+        disassemble(argv[arg + 1]);
     } else {
         printf("Error during assembly\n");
     }
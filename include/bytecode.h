@@ -15,6 +15,19 @@
 #define INCLUDE_BYTECODE_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define BYTECODE_MAGIC      "\x7fRVM"     // Never a valid first opcode, so files without a header still load
+#define BYTECODE_VERSION    2               // ISA version, 1 is the original 8 registers ISA without a header
+
+/* Optional header of a byte code file, the code follows it and starts at address 0 */
+struct bytecode_header {
+    char magic[4];              // BYTECODE_MAGIC
+    uint32_t version;           // ISA version the code needs, little endian
+};
+
+typedef struct bytecode_header bytecode_header_t;
 
 struct byte_code_file {
     uint8_t *buffer;
@@ -25,5 +38,6 @@ typedef struct byte_code_file binfile_t;
 
 binfile_t binfile_get(const char *filename);
 void binfile_free(binfile_t *file);
+bool bytecode_code(const uint8_t *image, size_t size, const uint8_t **code, size_t *code_size, uint32_t *version);
 
 #endif // INCLUDE_BYTECODE_H_
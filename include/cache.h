@@ -0,0 +1,48 @@
+/* 
+ *
+ *      cache.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_CACHE_H_
+#define INCLUDE_CACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "decode.h"
+
+#ifndef RVM_VERSION
+    #define RVM_VERSION "unknown"
+#endif
+
+/* Header of a cache file, followed by the byte code and the decoded program */
+struct cache_header {
+    char magic[8];              // "RVMCACHE"
+    char version[16];           // VM version which wrote the file
+    uint64_t isa_hash;          // Hash of the instruction table
+    uint64_t isa_version;       // Byte code version, the same code decodes differently in version 1
+    uint64_t code_hash;         // Hash of the byte code
+    uint64_t code_size;         // Size of byte code
+    uint64_t insn_size;         // Size of a decoded instruction
+    uint64_t insns_offset;      // File offset of the decoded program
+};
+
+typedef struct cache_header cache_header_t;
+
+uint64_t cache_hash(const uint8_t *data, size_t size);
+
+bool cache_load(const char *dir, const uint8_t *code, size_t code_size, uint32_t version, decoded_program_t *prog);
+bool cache_load_key(const char *dir, uint64_t code_hash, decoded_program_t *prog, const uint8_t **code);
+bool cache_store(const char *dir, const uint8_t *code, size_t code_size, const decoded_program_t *prog);
+bool cache_get(const char *dir, const uint8_t *code, size_t code_size, uint32_t version, decoded_program_t *prog);
+
+#endif // INCLUDE_CACHE_H_
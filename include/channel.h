@@ -0,0 +1,58 @@
+/* 
+ *
+ *      channel.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_CHANNEL_H_
+#define INCLUDE_CHANNEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "vm.h"
+
+#define CHANNEL_CAPACITY        64          // Default number of messages in flight
+#define CHANNEL_MESSAGE_SIZE    0x1000      // Default largest message
+
+#define CHANNEL_IN              0           // Port receiving from the previous pipeline stage
+#define CHANNEL_OUT             1           // Port sending to the next pipeline stage
+
+/* Bounded lock-free MPMC queue of messages, each slot holds one message */
+struct channel {
+    _Atomic size_t tail;        // Next slot to send to
+    char pad0[64 - sizeof(size_t)];
+    _Atomic size_t head;        // Next slot to receive from
+    char pad1[64 - sizeof(size_t)];
+
+    _Atomic bool closed;        // No more messages are sent
+    size_t mask;                // Number of slots - 1
+    size_t message_size;        // Largest message
+    size_t slot_size;
+    uint8_t *slots;
+};
+
+typedef struct channel channel_t;
+
+channel_t *channel_create(size_t capacity, size_t message_size);
+void channel_destroy(channel_t *channel);
+void channel_close(channel_t *channel);
+
+bool channel_try_send(channel_t *channel, const void *data, size_t size);
+bool channel_try_recv(channel_t *channel, void *data, size_t capacity, size_t *size);
+bool channel_send(channel_t *channel, const void *data, size_t size);
+bool channel_recv(channel_t *channel, void *data, size_t capacity, size_t *size);
+
+bool channel_connect(vm_t *from, vm_t *to, size_t capacity, size_t message_size);
+bool channel_pipeline(vm_t *stages, size_t count);
+
+#endif // INCLUDE_CHANNEL_H_
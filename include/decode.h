@@ -0,0 +1,71 @@
+/* 
+ *
+ *      decode.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_DECODE_H_
+#define INCLUDE_DECODE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+/* Pre-decoded instruction, fixed width so it can be mapped from a cache file */
+struct decoded_insn {
+    uint64_t imm;           // Immediate operand
+    uint8_t opcode;         // Opcode
+    uint8_t length;         // Encoded length, 0 if unknown or incomplete
+    uint8_t regs[4];        // Register operands
+    uint8_t flags;          // DECODE_ flags set by decode_link
+    uint8_t reserved;
+};
+
+typedef struct decoded_insn decoded_insn_t;
+
+#define DECODE_STATIC   0x01        // Branch target is the constant in imm
+#define DECODE_ENTRY    0x02        // Analysed with no register known, any jump may land here
+#define DECODE_RETURN   0x04        // Return site, a RET may land here
+#define DECODE_REACHED  0x08        // Reached by the analysis, changing it drops the links
+
+/* Decoded program, one entry for every byte offset of the code */
+struct decoded_program {
+    decoded_insn_t *insns;  // Decoded instructions indexed by pc
+    size_t code_size;       // Size of byte code
+    uint32_t version;       // Byte code version, decides the register operand mask
+    void *mapping;          // Backing cache file mapping, NULL if allocated
+    size_t mapping_size;
+    bool analysed;          // decode_link ran
+    bool linked;            // DECODE_STATIC targets are valid
+};
+
+typedef struct decoded_program decoded_program_t;
+
+bool decode_program(decoded_program_t *prog, const uint8_t *code, size_t code_size, uint32_t version);
+void decode_refresh(decoded_program_t *prog, const uint8_t *code, size_t addr, size_t size);
+void decode_free(decoded_program_t *prog);
+
+void decode_link(decoded_program_t *prog, size_t entry, const size_t *registers);
+void decode_unlink(decoded_program_t *prog);
+
+/* Keep the decoded program of a VM in step with guest memory written by anything
+ * other than a store instruction, such as atomics, traps and file mappings */
+static inline void decode_written(vm_t *vm, size_t addr, size_t size) {
+    if (vm->program && size && addr < vm->program->code_size) {
+        decode_refresh(vm->program, vm->memory, addr, size);
+    }
+}
+
+void vm_run_decoded(vm_t *vm, decoded_program_t *prog);
+void vm_enter_decoded(vm_t *vm, decoded_program_t *prog);
+
+#endif // INCLUDE_DECODE_H_
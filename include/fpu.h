@@ -0,0 +1,52 @@
+/* 
+ *
+ *      fpu.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_FPU_H_
+#define INCLUDE_FPU_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/* Floating point instructions see registers as IEEE-754 binary64, shared by both engines */
+static inline double fpu_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Results are stored with NaN made canonical, which NaN the host propagates
+ * depends on the order the compiler picked for the operands */
+#define FPU_NAN     0x7ff8000000000000ULL
+
+static inline uint64_t fpu_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return isnan(value) ? FPU_NAN : bits;
+}
+
+/* Convert to a signed integer rounding toward zero, saturating out of range and 0 for NaN */
+static inline uint64_t fpu_to_int(double value) {
+    if (isnan(value)) {
+        return 0;
+    }
+    if (value >= 9223372036854775808.0) {
+        return (uint64_t)INT64_MAX;
+    }
+    if (value < -9223372036854775808.0) {
+        return (uint64_t)INT64_MIN;
+    }
+    return (uint64_t)(int64_t)value;
+}
+
+#endif // INCLUDE_FPU_H_
@@ -0,0 +1,40 @@
+/* 
+ *
+ *      fuzz.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_FUZZ_H_
+#define INCLUDE_FUZZ_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+#define FUZZ_MAP_SIZE       (1 << VM_COVERAGE_BITS) // Edge hit counts, see vm_branch
+#define FUZZ_SHM_ENV        "__AFL_SHM_ID"          // SysV shared memory id of the bitmap
+#define FUZZ_FORKSRV_FD     198                     // Commands from afl-fuzz, replies on the next fd
+#define FUZZ_BUDGET         0x100000                // Instructions an input may run
+#define FUZZ_MAX_INPUT      0x100000                // Longer inputs are cut
+
+struct fuzz_options {
+    const char *program;        // Byte code file
+    const char *corpus;         // Inputs run when not started by afl-fuzz
+    size_t memory_size;
+    bool decode;                // Run pre-decoded
+};
+
+typedef struct fuzz_options fuzz_options_t;
+
+int fuzz_run(const fuzz_options_t *options);
+
+#endif // INCLUDE_FUZZ_H_
@@ -0,0 +1,56 @@
+/* 
+ *
+ *      guard.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_GUARD_H_
+#define INCLUDE_GUARD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#if !defined(_WIN32)
+    #include <setjmp.h>
+#endif
+
+#include "vm.h"
+
+/* Recovery point of a run on this thread. A guest access hitting the guard pages
+ * after guest memory jumps back to it instead of crashing the host */
+struct vm_guard {
+    #if !defined(_WIN32)
+        sigjmp_buf env;
+    #endif
+    vm_t *vm;
+    size_t fault;               // Guest address that faulted
+    struct vm_guard *prev;      // Guard of an enclosing run on this thread
+};
+
+typedef struct vm_guard vm_guard_t;
+
+/* True on the way in, false after a fault. Must be used in the function that
+ * called vm_guard_enter, which must not return before vm_guard_leave:
+ *     vm_guard_enter(vm, &guard);
+ *     if (VM_GUARD_TRY(&guard)) run(vm); else vm_guard_fault(&guard);
+ *     vm_guard_leave(&guard);
+ */
+#if defined(_WIN32)
+    #define VM_GUARD_TRY(guard)     (1)
+#else
+    #define VM_GUARD_TRY(guard)     (sigsetjmp((guard)->env, 0) == 0)
+#endif
+
+void vm_guard_enter(vm_t *vm, vm_guard_t *guard);
+void vm_guard_fault(vm_guard_t *guard);
+void vm_guard_leave(vm_guard_t *guard);
+
+#endif // INCLUDE_GUARD_H_
@@ -14,6 +14,9 @@
 #ifndef INCLUDE_INSTRUCTION_H_
 #define INCLUDE_INSTRUCTION_H_
 
+#include <stdint.h>
+#include <stddef.h>
+
 enum instructions {
     OP_HALT = 0,    // Halt                         HLT
 
@@ -44,6 +47,69 @@ enum instructions {
     OP_TRAP,        // Trap                         TRAP    [REG] [NUMREG]
 
     OP_PRINT,       // Print register               PRT     [REG]
+
+    OP_PUSH,        // Push register                PUSH    [REG]
+    OP_POP,         // Pop register                 POP     [REG]
+    OP_CALL,        // Call subroutine              CALL    [ADDRREG]
+    OP_RET,         // Return from subroutine       RET
+
+    OP_SPAWN,       // Start thread                 SPAWN   [DEST] [ADDRREG] [STACKREG]
+    OP_JOIN,        // Wait for thread              JOIN    [DEST] [REG]
+    OP_CAS,         // Compare and swap             CAS     [DEST] [ADDRREG] [REG]
+    OP_FADD,        // Fetch and add                FADD    [DEST] [ADDRREG] [REG]
+    OP_XCHG,        // Exchange                     XCHG    [DEST] [ADDRREG] [REG]
+    OP_FENCE,       // Memory fence                 FENCE
+
+    OP_LDB,         // Load byte                    LDB     [DEST] [BASEREG] [OFFSET]
+    OP_LDBS,        // Load signed byte             LDBS    [DEST] [BASEREG] [OFFSET]
+    OP_LDH,         // Load 16 bits                 LDH     [DEST] [BASEREG] [OFFSET]
+    OP_LDHS,        // Load signed 16 bits          LDHS    [DEST] [BASEREG] [OFFSET]
+    OP_LDW,         // Load 32 bits                 LDW     [DEST] [BASEREG] [OFFSET]
+    OP_LDWS,        // Load signed 32 bits          LDWS    [DEST] [BASEREG] [OFFSET]
+    OP_LDQ,         // Load 64 bits                 LDQ     [DEST] [BASEREG] [OFFSET]
+    OP_STB,         // Store byte                   STB     [REG] [BASEREG] [OFFSET]
+    OP_STH,         // Store 16 bits                STH     [REG] [BASEREG] [OFFSET]
+    OP_STW,         // Store 32 bits                STW     [REG] [BASEREG] [OFFSET]
+    OP_STQ,         // Store 64 bits                STQ     [REG] [BASEREG] [OFFSET]
+
+    OP_SLT,         // Set if less than             SLT     [DEST] [REG] [REG]
+    OP_SLTU,        // Set if below                 SLTU    [DEST] [REG] [REG]
+    OP_SLE,         // Set if less or equal         SLE     [DEST] [REG] [REG]
+    OP_SLEU,        // Set if below or equal        SLEU    [DEST] [REG] [REG]
+    OP_SEL,         // Select if not zero           SEL     [DEST] [REG] [REG]
+
+    OP_BEQ,         // Branch if equal              BEQ     [REG] [REG] [ADDRREG]
+    OP_BNE,         // Branch if not equal          BNE     [REG] [REG] [ADDRREG]
+    OP_BLT,         // Branch if less than          BLT     [REG] [REG] [ADDRREG]
+    OP_BLTU,        // Branch if below              BLTU    [REG] [REG] [ADDRREG]
+
+    OP_FADDD,       // Float add                    FADDD   [DEST] [REG] [REG]
+    OP_FSUBD,       // Float subtract               FSUBD   [DEST] [REG] [REG]
+    OP_FMULD,       // Float multiply               FMULD   [DEST] [REG] [REG]
+    OP_FDIVD,       // Float divide                 FDIVD   [DEST] [REG] [REG]
+    OP_FMAD,        // Fused multiply add           FMAD    [DEST] [REG] [REG]
+    OP_FSQRTD,      // Float square root            FSQRTD  [DEST] [REG]
+    OP_FEQD,        // Float equal                  FEQD    [DEST] [REG] [REG]
+    OP_FLTD,        // Float less than              FLTD    [DEST] [REG] [REG]
+    OP_FLED,        // Float less or equal          FLED    [DEST] [REG] [REG]
+    OP_ITOF,        // Integer to float             ITOF    [DEST] [REG]
+    OP_FTOI,        // Float to integer             FTOI    [DEST] [REG]
+
+    OP_COUNT,       // Number of opcodes
+};
+
+/* Encoding of an instruction, operands are described one character each:
+ * 'r' is a register byte, 'i' is an 8 bytes little endian immediate */
+struct instruction_info {
+    const char *mnemonic;
+    const char *operands;
 };
 
+typedef struct instruction_info instruction_info_t;
+
+extern const instruction_info_t instruction_table[OP_COUNT];
+
+size_t instruction_length(uint8_t opcode);
+uint64_t instruction_table_hash(void);
+
 #endif // INCLUDE_INSTRUCTION_H_
@@ -14,7 +14,10 @@
 #ifndef INCLUDE_LOGGER_H_
 #define INCLUDE_LOGGER_H_
 
+#include <stdbool.h>
+
 void logger_error(const char *format, ...);
 void logger_print(const char *format, ...);
+void logger_set_verbose(bool verbose);
 
 #endif // INCLUDE_LOGGER_H_
@@ -0,0 +1,79 @@
+/* 
+ *
+ *      metrics.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_METRICS_H_
+#define INCLUDE_METRICS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "vm.h"
+
+#define METRICS_MAGIC       "RVMSTAT"
+#define METRICS_VERSION     1
+#define METRICS_SLOTS       64          // VMs and guest threads shown at once
+#define METRICS_TRAPS       16          // Traps counted one by one, the others in the last
+#define METRICS_INTERVAL    0xFFFF      // Publish every 64Ki instructions
+#define METRICS_PERIOD_NS   100000000   // Refresh rate and memory use every 100 ms
+
+/* Shared memory segment name of a process, /rvm-<pid> */
+#define METRICS_NAME        "/rvm-%ld"
+
+enum metrics_state {
+    METRICS_FREE = 0,
+    METRICS_RUNNING,
+};
+
+/* Counters of one running VM, written by its own thread only. Readers in
+ * other processes load each field on its own, fields may be a period apart */
+struct metrics_slot {
+    _Atomic uint32_t state;             // metrics_state
+    _Atomic uint32_t thread_id;         // Guest thread, 0 for the main one
+    _Atomic uint64_t started_ns;        // Monotonic clock when the VM started
+    _Atomic uint64_t updated_ns;        // Last publication
+    _Atomic uint64_t pc;
+    _Atomic uint64_t instructions;      // Instructions executed
+    _Atomic uint64_t ips;               // Instructions per second over the last period
+    _Atomic uint64_t branches;
+    _Atomic uint64_t memory_ops;
+    _Atomic uint64_t traps[METRICS_TRAPS];
+    _Atomic uint64_t io_ns;             // Time spent in traps doing I/O
+    _Atomic uint64_t memory_size;       // Guest memory
+    _Atomic uint64_t memory_peak;       // Most guest memory resident so far
+
+    /* Private to the writer */
+    uint64_t period_ns;
+    uint64_t period_instructions;
+};
+
+struct metrics_segment {
+    char magic[8];                      // "RVMSTAT"
+    uint32_t version;
+    uint32_t slots;
+    uint64_t pid;
+    struct metrics_slot slot[METRICS_SLOTS];
+};
+
+typedef struct metrics_slot metrics_slot_t;
+typedef struct metrics_segment metrics_segment_t;
+
+bool metrics_open(void);
+void metrics_close(void);
+void metrics_attach(vm_t *vm);
+void metrics_detach(vm_t *vm);
+void metrics_publish(vm_t *vm);
+void metrics_trap(vm_t *vm, size_t trap_number, uint64_t ns);
+
+#endif // INCLUDE_METRICS_H_
@@ -0,0 +1,33 @@
+/* 
+ *
+ *      perf.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_PERF_H_
+#define INCLUDE_PERF_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+#define PERF_TRAMPOLINE_SIZE    32          // Bytes of native code per guest function
+#define PERF_CHUNK_SIZE         0x10000     // Trampolines are allocated in chunks of this size
+
+/* Runs guest code of a frame until it returns, arg is given to perf_call */
+typedef void (*perf_frame_fn)(vm_t *vm, void *arg);
+
+bool perf_open(void);
+void perf_close(void);
+void perf_call(vm_t *vm, perf_frame_fn frame, void *arg);
+
+#endif // INCLUDE_PERF_H_
@@ -0,0 +1,31 @@
+/* 
+ *
+ *      sample.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_SAMPLE_H_
+#define INCLUDE_SAMPLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+#define SAMPLE_RATE         1000        // Default samples per second of CPU time
+#define SAMPLE_DEPTH        16          // Frames kept per sample, the pc included
+#define SAMPLE_CAPACITY     0x10000     // Samples kept, later ones are counted as dropped
+
+bool sample_start(unsigned rate);
+bool sample_stop(const char *path);
+void sample_attach(vm_t *vm);
+
+#endif // INCLUDE_SAMPLE_H_
@@ -0,0 +1,76 @@
+/* 
+ *
+ *      serve.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_SERVE_H_
+#define INCLUDE_SERVE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SERVE_MAGIC         "RVMJ"
+#define SERVE_MAX_PROGRAM   0x10000000      // 256 MiB
+#define SERVE_MAX_INPUT     0x40000000      // 1 GiB
+#define SERVE_CHUNK         0x10000         // Largest output frame
+
+/* What the program field of a request holds */
+enum serve_kind {
+    SERVE_CODE = 0,     // Byte code
+    SERVE_PATH,         // Path of a byte code file on the server
+    SERVE_KEY,          // 8 bytes cache key, needs --cache on the server
+};
+
+enum serve_frame_type {
+    SERVE_OUTPUT = 0,   // Guest output
+    SERVE_EXIT,         // 4 bytes exit status, last frame of a job
+};
+
+enum serve_status {
+    SERVE_OK = 0,       // Program halted
+    SERVE_FAULT,        // Program stopped by an error
+    SERVE_BAD_REQUEST,  // Program could not be loaded
+};
+
+/* Job request, followed by the program and the input */
+struct serve_request {
+    char magic[4];              // "RVMJ"
+    uint32_t kind;              // serve_kind
+    uint64_t memory_size;       // Guest memory size, 0 for the server default
+    uint64_t program_size;      // Size of the program field
+    uint64_t input_size;        // Size of guest input
+};
+
+/* Reply frame header, followed by size bytes */
+struct serve_frame {
+    uint32_t type;              // serve_frame_type
+    uint32_t size;
+};
+
+typedef struct serve_request serve_request_t;
+typedef struct serve_frame serve_frame_t;
+
+struct serve_options {
+    const char *socket_path;
+    const char *cache_dir;      // Cache of decoded programs, NULL for none
+    bool decode;                // Run pre-decoded programs
+    int workers;                // Worker threads, each with its own memory arena
+    size_t memory_size;         // Size of a memory arena
+    bool perf;                  // Name guest functions in the perf map, see perf_open()
+};
+
+typedef struct serve_options serve_options_t;
+
+int serve_run(const serve_options_t *options);
+int serve_submit(const char *socket_path, uint32_t kind, const char *program, size_t memsize);
+
+#endif // INCLUDE_SERVE_H_
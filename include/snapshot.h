@@ -0,0 +1,50 @@
+/* 
+ *
+ *      snapshot.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_SNAPSHOT_H_
+#define INCLUDE_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+#define SNAPSHOT_MAGIC      "RVMSNAP"
+#define SNAPSHOT_VERSION    3
+
+/* Header of a snapshot file, followed by the index of the stored pages
+ * and the page data at data_offset, aligned to page_size */
+struct snapshot_header {
+    char magic[8];              // "RVMSNAP"
+    uint64_t version;           // Snapshot format version
+    uint64_t page_size;         // Size of a stored page
+    uint64_t num_pages;         // Number of stored pages
+    uint64_t data_offset;       // File offset of the first page
+
+    uint64_t registers[VM_REGISTERS];
+    uint64_t pc;
+    uint64_t running;
+    uint64_t code_size;
+    uint64_t memory_size;
+    uint64_t sp;
+    uint64_t stack_base;
+    uint64_t stack_top;
+    uint64_t isa_version;       // Byte code version of the program
+};
+
+typedef struct snapshot_header snapshot_header_t;
+
+bool snapshot_save(const vm_t *vm, const char *path);
+bool snapshot_restore(vm_t *vm, const char *path);
+
+#endif // INCLUDE_SNAPSHOT_H_
@@ -0,0 +1,31 @@
+/* 
+ *
+ *      thread.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_THREAD_H_
+#define INCLUDE_THREAD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+bool vm_spawn(vm_t *vm, size_t entry, size_t stack, uint8_t reg);
+bool vm_join(vm_t *vm, size_t id, size_t *value);
+void vm_join_all(vm_t *vm);
+void vm_threads_free(vm_t *vm);
+
+bool vm_atomic(vm_t *vm, uint8_t opcode, size_t addr, size_t value, size_t *result);
+void vm_fence(void);
+
+#endif // INCLUDE_THREAD_H_
@@ -0,0 +1,27 @@
+/* 
+ *
+ *      tier.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_TIER_H_
+#define INCLUDE_TIER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+#define TIER_THRESHOLD      1000        // Default entries of a block before the program is decoded
+
+void vm_run_tiered(vm_t *vm, uint32_t threshold, const char *cache_dir);
+
+#endif // INCLUDE_TIER_H_
@@ -23,9 +23,43 @@
 enum trap_number {
     TRAP_PUTC = 0,  // Print character to stdout
     TRAP_GETC,      // Get character from stdin
+    TRAP_SNAPSHOT,  // Write snapshot, value register is 0 here and 1 after restore
+    TRAP_SEND,      // Send buffer to a channel port
+    TRAP_RECV,      // Receive message from a channel port
+    TRAP_CLOSE,     // Close a channel port
+    TRAP_READ,      // Read into a buffer from a file
+    TRAP_WRITE,     // Write a buffer to a file
+    TRAP_WRITEV,    // Write a list of buffers to a file
+    TRAP_MMAP,      // Map a file into guest memory
+    TRAP_MUNMAP,    // Remove a file mapping
+    TRAP_CLOCK,     // Monotonic clock in nanoseconds
+    TRAP_COUNTER,   // Read an event counter of the VM
+    TRAP_PUTF,      // Print a binary64 float to stdout
 };
 
+/* Traps taking several arguments read them from the value register and the
+ * ones following it, wrapping around, and return their result in the first */
+#define TRAP_ARG(vm, reg, n)    ((vm)->registers[((reg) + (n)) & (vm)->register_mask])
+
+void trap_call(vm_t *vm, size_t trap_number, uint8_t reg);
+
 void trap_putc(vm_t *vm, uint8_t reg);
 void trap_getc(vm_t *vm, uint8_t reg);
+void trap_snapshot(vm_t *vm, uint8_t reg);
+void trap_send(vm_t *vm, uint8_t reg);
+void trap_recv(vm_t *vm, uint8_t reg);
+void trap_close(vm_t *vm, uint8_t reg);
+void trap_read(vm_t *vm, uint8_t reg);
+void trap_write(vm_t *vm, uint8_t reg);
+void trap_writev(vm_t *vm, uint8_t reg);
+void trap_mmap(vm_t *vm, uint8_t reg);
+void trap_munmap(vm_t *vm, uint8_t reg);
+void trap_clock(vm_t *vm, uint8_t reg);
+void trap_counter(vm_t *vm, uint8_t reg);
+void trap_putf(vm_t *vm, uint8_t reg);
+
+uint64_t trap_clock_ns(void);
+
+bool trap_buffer(vm_t *vm, size_t addr, size_t size);
 
 #endif // INCLUDE_TRAP_H_
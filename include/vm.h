@@ -14,25 +14,131 @@
 #ifndef INCLUDE_VM_H_
 #define INCLUDE_VM_H_
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
 
+#define VM_REGISTERS    16          // General registers R0 to R15
+#define VM_REGISTER_MASK (VM_REGISTERS - 1)     // Bits of a register operand byte naming the register
+#define VM_REGISTER_MASK_V1 0x07                // Version 1 byte code names R0 to R7 with the low 3 bits
+#define VM_STACK_SIZE   0x1000      // Default stack size in bytes
+#define VM_RAS_DEPTH    64          // Depth of the shadow return address stack
+#define VM_CHANNELS     4           // Channel ports of a VM
+#define VM_FILES        16          // Guest file numbers, 0 to 2 are the standard streams
+#define VM_REGIONS      16          // Host files mapped into a VM
+#define VM_COVERAGE_BITS 16         // Edge coverage map of 64 KiB, as afl-fuzz expects
+
+struct vm_threads;
+struct channel;
+struct decoded_program;
+struct metrics_slot;
+struct vm_watches;
+
+/* Event counters, read by the guest with TRAP_COUNTER */
+enum vm_counter {
+    VM_COUNTER_INSTRUCTIONS = 0,    // Instructions executed
+    VM_COUNTER_BRANCHES,            // Taken jumps, calls and returns
+    VM_COUNTER_MEMORY,              // Loads, stores, stack and atomic accesses
+    VM_COUNTER_TRAPS,               // Traps called
+    VM_COUNTER_COUNT,
+};
+
+/* Host file mapped into guest memory */
+struct vm_region {
+    size_t addr;            // Guest address, page aligned
+    size_t size;            // Whole pages
+    bool writable;          // Private copy-on-write, read-only if false
+};
+
+typedef struct vm_region vm_region_t;
+
 /* VM state */
 struct vm_state {
-    size_t registers[8];    // 8 common registers
+    size_t registers[VM_REGISTERS];     // General registers
     uint8_t *memory;        // Memory pointer
     size_t pc;              // Program counter
+    size_t insn_pc;         // Start of the instruction being run, pc moves over its operands
     bool running;           // Running flag
     size_t code_size;       // Size of byte code
+    uint32_t version;       // Byte code version of the program, see vm_set_version
+    uint8_t register_mask;  // Applied to register operand bytes
     size_t memory_size;
+    size_t memory_mask;     // Applied to guest addresses, see vmem_mask
+
+    size_t sp;              // Stack pointer, stack grows down from stack_top
+    size_t stack_base;      // Lowest address of the stack region
+    size_t stack_top;       // End of the stack region
+
+    size_t ras[VM_RAS_DEPTH];   // Shadow return address stack
+    size_t ras_depth;           // Entries in use, may exceed VM_RAS_DEPTH
+
+    const char *snapshot_path;  // Written by TRAP_SNAPSHOT, NULL if disabled
+
+    int memory_fd;          // File backing memory shared with clones, -1 if none
+
+    FILE *input;            // Guest stdin, NULL for none
+    FILE *output;           // Guest stdout
+    bool halted;            // Stopped by HLT or end of program, not by an error
+
+    struct vm_threads *threads;         // Guest threads, NULL until the first SPAWN
+    size_t thread_id;                   // 0 for the main thread
+    struct decoded_program *program;    // Decoded program being run, NULL in the interpreter
+    bool perf;                          // Enter guest functions through perf trampolines
+
+    struct channel *channels[VM_CHANNELS];  // Ports for TRAP_SEND and TRAP_RECV, NULL if unconnected
+
+    int files[VM_FILES];    // Host fds of guest files from 3 up, -1 if not open, owned by the host
+
+    vm_region_t regions[VM_REGIONS];    // Host files mapped over guest memory
+    size_t num_regions;
+
+    uint64_t counters[VM_COUNTER_COUNT];    // Counted by this VM or guest thread only
+    struct metrics_slot *metrics;           // Published counters while running, NULL when off
+    uint64_t budget;                        // Pause once this many instructions ran, 0 for none
+    uint64_t event_at;                      // Instruction count calling vm_event() next
+    bool paused;                            // Stopped by the budget or a watchpoint, can be resumed
+
+    struct vm_watches *watches;             // Watchpoints, shared with guest threads, NULL for none
+    bool watch_pending;                     // A watched page was opened for a write, see vm_watch_check
+
+    uint8_t *coverage;                      // Edge hit counts for fuzzing, NULL when off, see vm_branch
 };
 
 typedef struct vm_state vm_t;
 
+/* Register operand bytes are masked by the ISA version, so old files keep their meaning */
+static inline uint8_t vm_register_mask(uint32_t version) {
+    return (version == 1) ? VM_REGISTER_MASK_V1 : VM_REGISTER_MASK;
+}
+
+/* Take a branch, vm->pc still pointing past the branch instruction. When fuzzing
+ * the edge is counted, keyed by both ends so branches to one target differ */
+static inline void vm_branch(vm_t *vm, size_t target) {
+    if (vm->coverage) {
+        uint32_t edge = (uint32_t)vm->pc * 2654435761u ^ (uint32_t)target * 2246822519u;
+        vm->coverage[edge >> (32 - VM_COVERAGE_BITS)]++;
+    }
+
+    vm->pc = target;
+    vm->counters[VM_COUNTER_BRANCHES]++;
+}
+
 void vm_init(vm_t *vm, uint8_t *code, size_t code_size, size_t memsize);
+void vm_init_memory(vm_t *vm, uint8_t *memory, uint8_t *code, size_t code_size, size_t memsize);
+void vm_set_version(vm_t *vm, uint32_t version);
+int vm_status(const vm_t *vm);
+void vm_destroy(vm_t *vm);
+bool vm_clone(vm_t *clone, vm_t *template_vm);
 void vm_execute(vm_t *vm);
+bool vm_event(vm_t *vm);
+void vm_schedule(vm_t *vm);
 void vm_run(vm_t *vm);
+int vm_add_file(vm_t *vm, int fd);
+size_t vm_map_file(vm_t *vm, size_t addr, size_t size, int fd, uint64_t offset, bool writable);
+bool vm_unmap_file(vm_t *vm, size_t addr);
+void vm_unmap_files(vm_t *vm);
+bool vm_writable(vm_t *vm, size_t addr, size_t size);
 
 void op_load_handler(vm_t *vm);
 void op_la_handler(vm_t *vm);
@@ -55,5 +161,51 @@ void op_jz_handler(vm_t *vm);
 void op_loop_handler(vm_t *vm);
 void op_trap_handler(vm_t *vm);
 void op_print_handler(vm_t *vm);
+void op_push_handler(vm_t *vm);
+void op_pop_handler(vm_t *vm);
+void op_call_handler(vm_t *vm);
+void op_ret_handler(vm_t *vm);
+void op_spawn_handler(vm_t *vm);
+void op_join_handler(vm_t *vm);
+void op_cas_handler(vm_t *vm);
+void op_fadd_handler(vm_t *vm);
+void op_xchg_handler(vm_t *vm);
+void op_fence_handler(vm_t *vm);
+void op_ldb_handler(vm_t *vm);
+void op_ldbs_handler(vm_t *vm);
+void op_ldh_handler(vm_t *vm);
+void op_ldhs_handler(vm_t *vm);
+void op_ldw_handler(vm_t *vm);
+void op_ldws_handler(vm_t *vm);
+void op_ldq_handler(vm_t *vm);
+void op_stb_handler(vm_t *vm);
+void op_sth_handler(vm_t *vm);
+void op_stw_handler(vm_t *vm);
+void op_stq_handler(vm_t *vm);
+void op_slt_handler(vm_t *vm);
+void op_sltu_handler(vm_t *vm);
+void op_sle_handler(vm_t *vm);
+void op_sleu_handler(vm_t *vm);
+void op_sel_handler(vm_t *vm);
+void op_beq_handler(vm_t *vm);
+void op_bne_handler(vm_t *vm);
+void op_blt_handler(vm_t *vm);
+void op_bltu_handler(vm_t *vm);
+void op_faddd_handler(vm_t *vm);
+void op_fsubd_handler(vm_t *vm);
+void op_fmuld_handler(vm_t *vm);
+void op_fdivd_handler(vm_t *vm);
+void op_fmad_handler(vm_t *vm);
+void op_fsqrtd_handler(vm_t *vm);
+void op_feqd_handler(vm_t *vm);
+void op_fltd_handler(vm_t *vm);
+void op_fled_handler(vm_t *vm);
+void op_itof_handler(vm_t *vm);
+void op_ftoi_handler(vm_t *vm);
+
+bool vm_push(vm_t *vm, size_t value);
+bool vm_pop(vm_t *vm, size_t *value);
+bool vm_call(vm_t *vm, size_t addr);
+bool vm_return(vm_t *vm);
 
 #endif // INCLUDE_VM_H_
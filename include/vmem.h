@@ -0,0 +1,79 @@
+/* 
+ *
+ *      vmem.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_VMEM_H_
+#define INCLUDE_VMEM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Guest memory is little endian, accesses of any alignment are single host loads and stores */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    #define VMEM_LE16(x)    __builtin_bswap16(x)
+    #define VMEM_LE32(x)    __builtin_bswap32(x)
+    #define VMEM_LE64(x)    __builtin_bswap64(x)
+#else
+    #define VMEM_LE16(x)    (x)
+    #define VMEM_LE32(x)    (x)
+    #define VMEM_LE64(x)    (x)
+#endif
+
+#define VMEM_NONE       0       // Guard page
+#define VMEM_READ       1       // Read only, a write faults
+#define VMEM_WRITE      3       // Read and write
+
+/* Load size bytes, 1, 2, 4 or 8, zero extended */
+static inline uint64_t vmem_load(const uint8_t *p, size_t size) {
+    switch (size) {
+        case 1: return *p;
+        case 2: { uint16_t v; memcpy(&v, p, 2); return VMEM_LE16(v); }
+        case 4: { uint32_t v; memcpy(&v, p, 4); return VMEM_LE32(v); }
+        default: { uint64_t v; memcpy(&v, p, 8); return VMEM_LE64(v); }
+    }
+}
+
+/* Store the low size bytes of value */
+static inline void vmem_store(uint8_t *p, size_t size, uint64_t value) {
+    switch (size) {
+        case 1: *p = (uint8_t)value; break;
+        case 2: { uint16_t v = VMEM_LE16((uint16_t)value); memcpy(p, &v, 2); break; }
+        case 4: { uint32_t v = VMEM_LE32((uint32_t)value); memcpy(p, &v, 4); break; }
+        default: { uint64_t v = VMEM_LE64(value); memcpy(p, &v, 8); break; }
+    }
+}
+
+/* Sign extend the low size bytes of value */
+static inline uint64_t vmem_extend(uint64_t value, size_t size) {
+    unsigned shift = 64 - (unsigned)size * 8;
+    return (uint64_t)((int64_t)(value << shift) >> shift);
+}
+
+size_t vmem_page_size(void);
+size_t vmem_round(size_t size);
+size_t vmem_mask(size_t size);
+size_t vmem_reserved(size_t size);
+
+uint8_t *vmem_alloc(size_t size);
+void vmem_free(uint8_t *memory, size_t size);
+void vmem_reset(uint8_t *memory, size_t size);
+void vmem_clear(uint8_t *memory, size_t size);
+bool vmem_protect(uint8_t *addr, size_t size, int access);
+bool vmem_map_file(uint8_t *addr, size_t size, int fd, uint64_t offset, bool writable);
+bool vmem_map_zero(uint8_t *addr, size_t size);
+
+int vmem_share(uint8_t *memory, size_t size);
+uint8_t *vmem_map_shared(int fd, size_t size);
+
+#endif // INCLUDE_VMEM_H_
@@ -0,0 +1,45 @@
+/* 
+ *
+ *      watch.h
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#ifndef INCLUDE_WATCH_H_
+#define INCLUDE_WATCH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+#define VM_WATCHES      16          // Watchpoints of a VM
+
+/* Range of guest memory reported when written */
+struct vm_watch {
+    size_t addr;
+    size_t size;
+    bool stop;                  // Pause the VM when it is written
+    uint8_t *copy;              // Contents last reported
+};
+
+/* Watchpoints of a VM, shared by its threads */
+struct vm_watches {
+    struct vm_watch list[VM_WATCHES];
+    size_t count;
+};
+
+bool vm_watch(vm_t *vm, size_t addr, size_t size, bool stop);
+void vm_unwatch_all(vm_t *vm);
+bool vm_watch_fault(vm_t *vm, size_t addr);
+void vm_watch_write(vm_t *vm, size_t addr, size_t size);
+void vm_watch_check(vm_t *vm);
+
+#endif // INCLUDE_WATCH_H_
@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "logger.h"
 #include "bytecode.h"
@@ -68,3 +69,31 @@ void binfile_free(binfile_t *file) {
         file->file_size = 0;
     }
 }
+
+/* Find the code of a byte code image and its ISA version, after its header if there
+ * is one. False if the image needs a newer ISA than this VM runs */
+bool bytecode_code(const uint8_t *image, size_t size, const uint8_t **code, size_t *code_size, uint32_t *version) {
+    *code = image;
+    *code_size = size;
+    *version = 1;
+
+    if (size < sizeof(bytecode_header_t) || memcmp(image, BYTECODE_MAGIC, 4) != 0) {
+        return true;    // Version 1
+    }
+
+    uint32_t number = 0;
+    for (int i = 0; i < 4; i++) {
+        number |= (uint32_t)image[4 + i] << (i * 8);
+    }
+
+    if (number == 0 || number > BYTECODE_VERSION) {
+        logger_error("Unsupported byte code version %u, this VM runs up to %u\n", number, BYTECODE_VERSION);
+        return false;
+    }
+
+    *code = image + sizeof(bytecode_header_t);
+    *code_size = size - sizeof(bytecode_header_t);
+    *version = number;
+
+    return true;
+}
@@ -0,0 +1,286 @@
+/* 
+ *
+ *      cache.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(_WIN32)
+    #include <direct.h>
+    #include <process.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#include "instruction.h"
+#include "logger.h"
+#include "decode.h"
+#include "cache.h"
+
+#define CACHE_MAGIC "RVMCACHE"
+#define CACHE_ALIGN 64
+
+static _Atomic unsigned long cache_serial;     // Tells apart temporary files of threads in one process
+
+/* FNV-1a hash, used as the content address of a program */
+uint64_t cache_hash(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static void cache_path(char *path, size_t size, const char *dir, uint64_t code_hash) {
+    snprintf(path, size, "%s/%016llx.rvmc", dir, (unsigned long long)code_hash);
+}
+
+static void cache_fill_header(cache_header_t *header, const uint8_t *code, size_t code_size, uint32_t version) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+    strncpy(header->version, RVM_VERSION, sizeof(header->version) - 1);
+
+    header->isa_hash = instruction_table_hash();
+    header->isa_version = version;
+    header->code_hash = cache_hash(code, code_size);
+    header->code_size = code_size;
+    header->insn_size = sizeof(decoded_insn_t);
+    header->insns_offset = (sizeof(cache_header_t) + code_size + CACHE_ALIGN - 1) & ~(uint64_t)(CACHE_ALIGN - 1);
+}
+
+/* Check a cache file image against the byte code it should describe */
+static bool cache_check(const uint8_t *image, size_t image_size, const cache_header_t *expect, const uint8_t *code) {
+    if (image_size < sizeof(cache_header_t)) {
+        return false;
+    }
+
+    cache_header_t header;
+    memcpy(&header, image, sizeof(header));
+
+    /* Header also covers VM version and ISA, so an upgrade invalidates the file */
+    if (memcmp(&header, expect, sizeof(header)) != 0) {
+        return false;
+    }
+
+    if (header.insns_offset + header.code_size * header.insn_size > image_size) {
+        return false;
+    }
+
+    /* Compare the code itself, the hash alone may collide */
+    return memcmp(image + sizeof(cache_header_t), code, header.code_size) == 0;
+}
+
+/* Map a cache file privately, self modifying code only dirties our copy */
+static uint8_t *cache_open(const char *path, size_t *image_size) {
+    #if defined(_WIN32)
+        FILE *fp = fopen(path, "rb");
+        if (fp == NULL) {
+            return NULL;
+        }
+
+        fseek(fp, 0, SEEK_END);
+        long size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+
+        uint8_t *image = (size > 0) ? (uint8_t *)malloc(size) : NULL;
+        if (image != NULL && fread(image, 1, size, fp) != (size_t)size) {
+            free(image);
+            image = NULL;
+        }
+        fclose(fp);
+
+        *image_size = (size_t)size;
+        return image;
+    #else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return NULL;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            close(fd);
+            return NULL;
+        }
+
+        void *image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        *image_size = st.st_size;
+        return (image == MAP_FAILED) ? NULL : (uint8_t *)image;
+    #endif
+}
+
+static void cache_close(uint8_t *image, size_t image_size) {
+    #if defined(_WIN32)
+        (void)image_size;
+        free(image);
+    #else
+        munmap(image, image_size);
+    #endif
+}
+
+/* Load a decoded program from the cache, false on miss */
+bool cache_load(const char *dir, const uint8_t *code, size_t code_size, uint32_t version, decoded_program_t *prog) {
+    cache_header_t expect;
+    cache_fill_header(&expect, code, code_size, version);
+
+    char path[4096];
+    cache_path(path, sizeof(path), dir, expect.code_hash);
+
+    memset(prog, 0, sizeof(*prog));
+
+    size_t image_size;
+    uint8_t *image = cache_open(path, &image_size);
+    if (image == NULL) {
+        return false;
+    }
+
+    if (!cache_check(image, image_size, &expect, code)) {
+        cache_close(image, image_size);
+        return false;
+    }
+
+    prog->insns = (decoded_insn_t *)(image + expect.insns_offset);
+    prog->code_size = code_size;
+    prog->version = version;
+    prog->mapping = image;
+    prog->mapping_size = image_size;
+
+    return true;
+}
+
+/* Load a decoded program by its cache key alone, code points to the byte code kept in the file */
+bool cache_load_key(const char *dir, uint64_t code_hash, decoded_program_t *prog, const uint8_t **code) {
+    char path[4096];
+    cache_path(path, sizeof(path), dir, code_hash);
+
+    memset(prog, 0, sizeof(*prog));
+
+    size_t image_size;
+    uint8_t *image = cache_open(path, &image_size);
+    if (image == NULL) {
+        return false;
+    }
+
+    if (image_size < sizeof(cache_header_t)) {
+        cache_close(image, image_size);
+        return false;
+    }
+
+    cache_header_t header;
+    memcpy(&header, image, sizeof(header));
+
+    const uint8_t *stored = image + sizeof(cache_header_t);
+    bool ok = header.code_size <= image_size - sizeof(cache_header_t) &&
+              header.code_hash == code_hash &&
+              cache_hash(stored, header.code_size) == code_hash;
+
+    /* Same checks as a lookup by content */
+    cache_header_t expect;
+    if (ok) {
+        cache_fill_header(&expect, stored, header.code_size, (uint32_t)header.isa_version);
+        ok = cache_check(image, image_size, &expect, stored);
+    }
+
+    if (!ok) {
+        cache_close(image, image_size);
+        return false;
+    }
+
+    prog->insns = (decoded_insn_t *)(image + expect.insns_offset);
+    prog->code_size = header.code_size;
+    prog->version = (uint32_t)header.isa_version;
+    prog->mapping = image;
+    prog->mapping_size = image_size;
+    *code = stored;
+
+    return true;
+}
+
+/* Write a decoded program to the cache */
+bool cache_store(const char *dir, const uint8_t *code, size_t code_size, const decoded_program_t *prog) {
+    cache_header_t header;
+    cache_fill_header(&header, code, code_size, prog->version);
+
+    char path[4096], tmp_path[4096 + 48];
+    cache_path(path, sizeof(path), dir, header.code_hash);
+
+    /* Every writer gets its own temporary file, server workers store from one process */
+    unsigned long serial = atomic_fetch_add_explicit(&cache_serial, 1, memory_order_relaxed);
+    #if defined(_WIN32)
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%lu.tmp", path, _getpid(), serial);
+    #else
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.%lu.tmp", path, (long)getpid(), serial);
+    #endif
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        logger_error("Failed to create cache file: %s\n", tmp_path);
+        return false;
+    }
+
+    static const uint8_t padding[CACHE_ALIGN] = {0};
+    size_t pad = header.insns_offset - sizeof(header) - code_size;
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(code, 1, code_size, fp) == code_size &&
+              fwrite(padding, 1, pad, fp) == pad &&
+              fwrite(prog->insns, sizeof(decoded_insn_t), code_size, fp) == code_size;
+
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+
+    /* Publish atomically, a reader maps either a whole older file or this one */
+    #if defined(_WIN32)
+        remove(path);
+    #endif
+    if (!ok || rename(tmp_path, path) != 0) {
+        logger_error("Failed to write cache file: %s\n", path);
+        remove(tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+/* Get a verified and decoded program, from the cache when possible */
+bool cache_get(const char *dir, const uint8_t *code, size_t code_size, uint32_t version, decoded_program_t *prog) {
+    if (cache_load(dir, code, code_size, version, prog)) {
+        logger_print("Cache hit: %s\n", dir);
+        return true;
+    }
+
+    if (!decode_program(prog, code, code_size, version)) {
+        return false;
+    }
+
+    #if defined(_WIN32)
+        _mkdir(dir);
+    #else
+        mkdir(dir, 0755);
+    #endif
+
+    cache_store(dir, code, code_size, prog);
+
+    return true;
+}
@@ -0,0 +1,284 @@
+/* 
+ *
+ *      channel.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+#include "logger.h"
+#include "vm.h"
+#include "decode.h"
+#include "channel.h"
+
+/* Slot header, followed by the message */
+struct channel_slot {
+    _Atomic size_t sequence;    // Position the slot is ready for
+    size_t size;
+};
+
+typedef struct channel_slot channel_slot_t;
+
+static channel_slot_t *channel_slot(channel_t *channel, size_t pos) {
+    return (channel_slot_t *)(channel->slots + (pos & channel->mask) * channel->slot_size);
+}
+
+/* Create a channel of at least capacity messages of up to message_size bytes */
+channel_t *channel_create(size_t capacity, size_t message_size) {
+    size_t slots = 2;
+    while (slots < capacity) {
+        slots *= 2;
+    }
+
+    channel_t *channel = (channel_t *)calloc(1, sizeof(channel_t));
+    if (channel == NULL) {
+        return NULL;
+    }
+
+    channel->mask = slots - 1;
+    channel->message_size = message_size;
+    channel->slot_size = (sizeof(channel_slot_t) + message_size + 63) & ~(size_t)63;
+    channel->slots = (uint8_t *)calloc(slots, channel->slot_size);
+    if (channel->slots == NULL) {
+        free(channel);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < slots; i++) {
+        atomic_init(&channel_slot(channel, i)->sequence, i);
+    }
+    atomic_init(&channel->tail, 0);
+    atomic_init(&channel->head, 0);
+    atomic_init(&channel->closed, false);
+
+    return channel;
+}
+
+void channel_destroy(channel_t *channel) {
+    if (channel == NULL) {
+        return;
+    }
+
+    free(channel->slots);
+    free(channel);
+}
+
+/* Stop sending, receivers still get the messages in flight */
+void channel_close(channel_t *channel) {
+    atomic_store_explicit(&channel->closed, true, memory_order_release);
+}
+
+/* Send without blocking, false if the channel is full or the message too long */
+bool channel_try_send(channel_t *channel, const void *data, size_t size) {
+    if (size > channel->message_size) {
+        return false;
+    }
+
+    size_t pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+    channel_slot_t *slot;
+
+    while (1) {
+        slot = channel_slot(channel, pos);
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&channel->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;   // Full
+        } else {
+            pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+        }
+    }
+
+    memcpy(slot + 1, data, size);
+    slot->size = size;
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+    return true;
+}
+
+/* Receive without blocking, false if the channel is empty.
+ * A message longer than capacity is cut, size is the length copied */
+bool channel_try_recv(channel_t *channel, void *data, size_t capacity, size_t *size) {
+    size_t pos = atomic_load_explicit(&channel->head, memory_order_relaxed);
+    channel_slot_t *slot;
+
+    while (1) {
+        slot = channel_slot(channel, pos);
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&channel->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;   // Empty
+        } else {
+            pos = atomic_load_explicit(&channel->head, memory_order_relaxed);
+        }
+    }
+
+    *size = (slot->size < capacity) ? slot->size : capacity;
+    memcpy(data, slot + 1, *size);
+    atomic_store_explicit(&slot->sequence, pos + channel->mask + 1, memory_order_release);
+
+    return true;
+}
+
+/* Back off while waiting for the other end, spinning first */
+static void channel_wait(unsigned *spins) {
+    if (++*spins < 64) {
+        return;
+    }
+
+    #if defined(_WIN32)
+        Sleep(0);
+    #else
+        sched_yield();
+    #endif
+}
+
+/* Send, waiting while the channel is full. False if it is closed */
+bool channel_send(channel_t *channel, const void *data, size_t size) {
+    if (size > channel->message_size) {
+        return false;
+    }
+
+    unsigned spins = 0;
+    while (!channel_try_send(channel, data, size)) {
+        if (atomic_load_explicit(&channel->closed, memory_order_acquire)) {
+            return false;
+        }
+        channel_wait(&spins);
+    }
+
+    return true;
+}
+
+/* Receive, waiting while the channel is empty. False once it is closed and drained */
+bool channel_recv(channel_t *channel, void *data, size_t capacity, size_t *size) {
+    unsigned spins = 0;
+    while (!channel_try_recv(channel, data, capacity, size)) {
+        if (atomic_load_explicit(&channel->closed, memory_order_acquire)) {
+            /* Messages sent before closing are still delivered */
+            return channel_try_recv(channel, data, capacity, size);
+        }
+        channel_wait(&spins);
+    }
+
+    return true;
+}
+
+/* Connect the output port of a VM to the input port of another, the
+ * channel belongs to the caller and is found in from->channels[CHANNEL_OUT] */
+bool channel_connect(vm_t *from, vm_t *to, size_t capacity, size_t message_size) {
+    channel_t *channel = channel_create(capacity, message_size);
+    if (channel == NULL) {
+        logger_error("Failed to allocate channel\n");
+        return false;
+    }
+
+    from->channels[CHANNEL_OUT] = channel;
+    to->channels[CHANNEL_IN] = channel;
+
+    return true;
+}
+
+#if defined(_WIN32)
+
+bool channel_pipeline(vm_t *stages, size_t count) {
+    (void)stages; (void)count;
+    logger_error("Pipelines are not supported on this platform\n");
+    return false;
+}
+
+#else
+
+/* Run a VM until it stops, then close its ports so neighbour stages do not wait forever */
+static void *channel_stage_main(void *arg) {
+    vm_t *vm = (vm_t *)arg;
+
+    if (vm->program) {
+        vm_run_decoded(vm, vm->program);
+    } else {
+        vm_run(vm);
+    }
+
+    for (int i = 0; i < VM_CHANNELS; i++) {
+        if (vm->channels[i]) {
+            channel_close(vm->channels[i]);
+        }
+    }
+
+    return NULL;
+}
+
+/* Run VMs as a pipeline, each on its own thread, stage n sending to stage n + 1.
+ * A stage runs pre-decoded when its program field is set */
+bool channel_pipeline(vm_t *stages, size_t count) {
+    pthread_t *threads = (pthread_t *)calloc(count, sizeof(pthread_t));
+    if (threads == NULL) {
+        logger_error("Failed to allocate pipeline\n");
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i + 1 < count && ok; i++) {
+        ok = channel_connect(&stages[i], &stages[i + 1], CHANNEL_CAPACITY, CHANNEL_MESSAGE_SIZE);
+    }
+
+    size_t started = 0;
+    for (; ok && started < count; started++) {
+        if (pthread_create(&threads[started], NULL, channel_stage_main, &stages[started]) != 0) {
+            logger_error("Failed to start stage %zu\n", started);
+            ok = false;
+            break;
+        }
+    }
+
+    /* Stages left out never drain their channels */
+    for (size_t i = 0; !ok && i + 1 < count; i++) {
+        if (stages[i].channels[CHANNEL_OUT]) {
+            channel_close(stages[i].channels[CHANNEL_OUT]);
+        }
+    }
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    for (size_t i = 0; i + 1 < count; i++) {
+        channel_destroy(stages[i].channels[CHANNEL_OUT]);
+        stages[i].channels[CHANNEL_OUT] = NULL;
+        stages[i + 1].channels[CHANNEL_IN] = NULL;
+    }
+
+    return ok;
+}
+
+#endif
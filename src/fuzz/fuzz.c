@@ -0,0 +1,267 @@
+/* 
+ *
+ *      fuzz.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32)
+    #include <errno.h>
+    #include <signal.h>
+    #include <unistd.h>
+    #include <dirent.h>
+    #include <sys/shm.h>
+#endif
+
+#include "logger.h"
+#include "bytecode.h"
+#include "vmem.h"
+#include "vm.h"
+#include "decode.h"
+#include "thread.h"
+#include "fuzz.h"
+
+#if defined(_WIN32)
+
+int fuzz_run(const fuzz_options_t *options) {
+    (void)options;
+    logger_error("Fuzzing is not supported on this platform\n");
+    return 1;
+}
+
+#else
+
+/* Program loaded once and run on every input in the same memory */
+struct fuzz_target {
+    vm_t initial;               // State before the first instruction
+    vm_t vm;
+    const uint8_t *code;
+    size_t code_size;
+    uint32_t version;           // Byte code version of the program
+    decoded_program_t prog;
+    bool decode;
+    FILE *null_output;
+    uint8_t *input;             // FUZZ_MAX_INPUT bytes
+};
+
+typedef struct fuzz_target fuzz_target_t;
+
+/* Bitmap shared with afl-fuzz, or our own when run alone */
+static uint8_t *fuzz_map(bool *shared) {
+    const char *id = getenv(FUZZ_SHM_ENV);
+    *shared = false;
+
+    if (id) {
+        void *map = shmat(atoi(id), NULL, 0);
+        if (map != (void *)-1) {
+            *shared = true;
+            return (uint8_t *)map;
+        }
+        logger_error("Failed to attach coverage map %s: %s\n", id, strerror(errno));
+    }
+
+    return (uint8_t *)calloc(1, FUZZ_MAP_SIZE);
+}
+
+/* Run one input from the initial state, the guest reads it on stdin.
+ * Returns the exit status of the VM */
+static int fuzz_exec(fuzz_target_t *target, const uint8_t *data, size_t size) {
+    vm_t *vm = &target->vm;
+
+    *vm = target->initial;
+    vm->input = size ? fmemopen((void *)data, size, "r") : NULL;
+
+    if (target->decode) {
+        vm_run_decoded(vm, &target->prog);
+    } else {
+        vm_run(vm);
+    }
+
+    vm_threads_free(vm);
+    vm_unmap_files(vm);
+    if (vm->input) fclose(vm->input);
+
+    int status = vm_status(vm);
+
+    /* Code the guest wrote is decoded again once it is restored */
+    bool code_written = memcmp(vm->memory, target->code, target->code_size) != 0;
+
+    /* Pages the input touched are zero filled again, the rest was never written */
+    vmem_clear(vm->memory, vm->memory_size);
+    memcpy(vm->memory, target->code, target->code_size);
+
+    if (code_written && target->decode) {
+        decode_refresh(&target->prog, vm->memory, 0, target->code_size);
+    }
+
+    return status;
+}
+
+/* Read a whole input from fd into the input buffer, cut at FUZZ_MAX_INPUT */
+static size_t fuzz_read(fuzz_target_t *target, int fd) {
+    size_t size = 0;
+
+    while (size < FUZZ_MAX_INPUT) {
+        ssize_t n = read(fd, target->input + size, FUZZ_MAX_INPUT - size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        size += (size_t)n;
+    }
+
+    return size;
+}
+
+/* Fork server protocol of afl-fuzz without forking: every run is reported as
+ * a child that is this process. A guest fault is reported as a SIGABRT crash */
+static bool fuzz_afl(fuzz_target_t *target) {
+    uint32_t hello = 0;
+    if (write(FUZZ_FORKSRV_FD + 1, &hello, 4) != 4) {
+        return false;
+    }
+
+    uint32_t command;
+    while (read(FUZZ_FORKSRV_FD, &command, 4) == 4) {
+        uint32_t pid = (uint32_t)getpid();
+        if (write(FUZZ_FORKSRV_FD + 1, &pid, 4) != 4) {
+            break;
+        }
+
+        /* afl-fuzz rewrites the input file behind stdin before each run */
+        lseek(0, 0, SEEK_SET);
+        size_t size = fuzz_read(target, 0);
+
+        uint32_t status = fuzz_exec(target, target->input, size) ? SIGABRT : 0;
+        if (write(FUZZ_FORKSRV_FD + 1, &status, 4) != 4) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+/* Run every file of the corpus, reporting faults and new edges */
+static int fuzz_corpus(fuzz_target_t *target, const char *corpus, uint8_t *map) {
+    DIR *dir = opendir(corpus);
+    if (dir == NULL) {
+        logger_error("Failed to open corpus %s: %s\n", corpus, strerror(errno));
+        return 1;
+    }
+
+    uint8_t *seen = (uint8_t *)calloc(1, FUZZ_MAP_SIZE);
+    if (seen == NULL) {
+        logger_error("Failed to allocate coverage map\n");
+        closedir(dir);
+        return 1;
+    }
+
+    size_t inputs = 0, faults = 0, edges = 0;
+    struct timespec start, finish;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", corpus, entry->d_name);
+
+        FILE *file = (entry->d_name[0] != '.') ? fopen(path, "rb") : NULL;
+        if (file == NULL) {
+            continue;
+        }
+        size_t size = fuzz_read(target, fileno(file));
+        fclose(file);
+
+        memset(map, 0, FUZZ_MAP_SIZE);
+        int status = fuzz_exec(target, target->input, size);
+        inputs++;
+
+        size_t fresh = 0;
+        for (size_t i = 0; i < FUZZ_MAP_SIZE; i++) {
+            if (map[i] && !seen[i]) {
+                seen[i] = 1;
+                fresh++;
+            }
+        }
+        edges += fresh;
+
+        if (status) {
+            faults++;
+            printf("%s: fault\n", path);
+        } else if (fresh) {
+            printf("%s: %zu new edges\n", path, fresh);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    double seconds = (double)(finish.tv_sec - start.tv_sec) + (double)(finish.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("Inputs: %zu, faults: %zu, edges: %zu\n", inputs, faults, edges);
+    printf("Total time: %f seconds, %.0f inputs per second\n", seconds, seconds > 0 ? inputs / seconds : 0.0);
+
+    free(seen);
+    closedir(dir);
+    return 0;
+}
+
+/* Load the program once, then run inputs from afl-fuzz or the corpus in this process.
+ * Between inputs only the VM state and the pages the guest touched are reset */
+int fuzz_run(const fuzz_options_t *options) {
+    fuzz_target_t target;
+    memset(&target, 0, sizeof(target));
+    logger_set_verbose(false);
+
+    binfile_t file = binfile_get(options->program);
+    if (file.buffer == NULL || !bytecode_code(file.buffer, file.file_size, &target.code, &target.code_size, &target.version) ||
+        target.code_size > options->memory_size) {
+        logger_error("Failed to load %s\n", options->program);
+        binfile_free(&file);
+        return 1;
+    }
+
+    bool shared;
+    uint8_t *map = fuzz_map(&shared);
+    uint8_t *memory = vmem_alloc(options->memory_size);
+    target.input = (uint8_t *)malloc(FUZZ_MAX_INPUT);
+    target.null_output = fopen("/dev/null", "w");
+    target.decode = options->decode;
+
+    int status = 1;
+
+    if (map == NULL || memory == NULL || target.input == NULL || target.null_output == NULL) {
+        logger_error("Failed to allocate fuzzing target\n");
+    } else if (!target.decode || decode_program(&target.prog, target.code, target.code_size, target.version)) {
+        vm_init_memory(&target.initial, memory, (uint8_t *)target.code, target.code_size, options->memory_size);
+        vm_set_version(&target.initial, target.version);
+        target.initial.output = target.null_output;
+        target.initial.coverage = map;
+        target.initial.budget = FUZZ_BUDGET;
+
+        status = fuzz_afl(&target) ? 0 : fuzz_corpus(&target, options->corpus, map);
+    }
+
+    decode_free(&target.prog);
+    if (target.null_output) fclose(target.null_output);
+    free(target.input);
+    if (memory) vmem_free(memory, options->memory_size);
+    if (shared) {
+        shmdt(map);
+    } else {
+        free(map);
+    }
+    binfile_free(&file);
+
+    return status;
+}
+
+#endif
@@ -16,6 +16,13 @@
 
 #include "logger.h"
 
+static bool logger_verbose = true;
+
+/* Enable or disable informational output, errors are always printed */
+void logger_set_verbose(bool verbose) {
+    logger_verbose = verbose;
+}
+
 void logger_error(const char *format, ...) {
     va_list args;
     va_start(args, format);
@@ -25,6 +32,10 @@ void logger_error(const char *format, ...) {
 }
 
 void logger_print(const char *format, ...) {
+    if (!logger_verbose) {
+        return;
+    }
+
     va_list args;
     va_start(args, format);
     fprintf(stdout, "[INFO] ");
@@ -19,61 +19,436 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <time.h>
+#include <fcntl.h>
+
+#if defined(_WIN32)
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
 
 #include "instruction.h"
 #include "vm.h"
 #include "bytecode.h"
 #include "logger.h"
+#include "decode.h"
+#include "cache.h"
+#include "snapshot.h"
+#include "serve.h"
+#include "channel.h"
+#include "perf.h"
+#include "sample.h"
+#include "metrics.h"
+#include "tier.h"
+#include "watch.h"
+#include "fuzz.h"
+
+#define MAX_STAGES  16      // Pipeline stages
+
+static void usage(void) {
+    printf("Usage: <RVM> [OPTIONS] [FILE] [MEMSIZE]\n");
+    printf("Options:\n");
+    printf("  --decode        Run pre-decoded program\n");
+    printf("  --cache DIR     Run pre-decoded program, cached in DIR\n");
+    printf("  --tier N        Interpret first, pre-decode once a block ran N times (0 for %d)\n", TIER_THRESHOLD);
+    printf("  --snapshot FILE Write snapshot to FILE on TRAP_SNAPSHOT\n");
+    printf("  --restore FILE  Resume from snapshot FILE instead of loading a program\n");
+    printf("  --serve SOCK    Run jobs sent to Unix socket SOCK, MEMSIZE is the largest memory\n");
+    printf("  --workers N     Number of jobs run in parallel by --serve\n");
+    printf("  --submit SOCK   Run FILE on the server at SOCK, stdin is the program input\n");
+    printf("  --by-path       Send the path of FILE instead of its contents\n");
+    printf("  --key HEX       Run the program cached under key HEX on the server\n");
+    printf("  --pipe FILE     Run FILE as the next pipeline stage, fed by channel port 1 of the previous one\n");
+    printf("  --read PATH     Open PATH for reading as the next guest file, from 3 up\n");
+    printf("  --write PATH    Create PATH for writing as the next guest file, from 3 up\n");
+    printf("  --perf          Write /tmp/perf-<pid>.map naming guest functions for perf\n");
+    printf("  --profile FILE  Sample the guest pc and call stack, write folded stacks to FILE\n");
+    printf("  --metrics       Publish live counters in shared memory for rvm-top\n");
+    printf("  --watch A[:N]   Report writes to N bytes (default 8) at guest address A\n");
+    printf("  --watch-stop    Stop the program after the first write to a watched range\n");
+    printf("  --fuzz DIR      Run each file in DIR as input of FILE in one process, or inputs from afl-fuzz\n");
+}
+
+/* Host file given to the guest */
+struct guest_file {
+    const char *path;
+    bool write;
+};
+
+/* Guest memory range given by --watch */
+struct watch_arg {
+    size_t addr;
+    size_t size;
+};
+
+/* Parse ADDR[:SIZE] */
+static bool parse_watch(const char *arg, struct watch_arg *watch) {
+    char *end;
+    watch->addr = strtoul(arg, &end, 0);
+    watch->size = 8;
+
+    if (end == arg) {
+        return false;
+    }
+    if (*end == ':') {
+        const char *size = end + 1;
+        watch->size = strtoul(size, &end, 0);
+        if (end == size) {
+            return false;
+        }
+    }
+
+    return *end == '\0';
+}
+
+/* Open host files as guest files 3 and up */
+static bool open_files(vm_t *vm, const struct guest_file *files, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        #if defined(_WIN32)
+            int fd = files[i].write ? _open(files[i].path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644)
+                                    : _open(files[i].path, _O_RDONLY | _O_BINARY);
+        #else
+            int fd = files[i].write ? open(files[i].path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+                                    : open(files[i].path, O_RDONLY);
+        #endif
+
+        if (fd < 0 || vm_add_file(vm, fd) < 0) {
+            logger_error("Failed to open %s\n", files[i].path);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void close_files(vm_t *vm) {
+    for (int i = 3; i < VM_FILES; i++) {
+        if (vm->files[i] >= 0) {
+            #if defined(_WIN32)
+                _close(vm->files[i]);
+            #else
+                close(vm->files[i]);
+            #endif
+            vm->files[i] = -1;
+        }
+    }
+}
+
+/* Run programs as pipeline stages connected by channels */
+static int run_pipeline(const char **files, size_t count, size_t memsize, bool decode, const char *cache_dir,
+                        bool perf) {
+    vm_t *stages = (vm_t *)calloc(count, sizeof(vm_t));
+    decoded_program_t *progs = (decoded_program_t *)calloc(count, sizeof(decoded_program_t));
+    if (stages == NULL || progs == NULL) {
+        logger_error("Failed to allocate pipeline\n");
+        return 1;
+    }
+
+    bool ok = true;
+    size_t loaded = 0;
+    for (; loaded < count && ok; loaded++) {
+        binfile_t file = binfile_get(files[loaded]);
+        const uint8_t *code;
+        size_t code_size;
+        uint32_t version;
+        if (file.buffer == NULL || !bytecode_code(file.buffer, file.file_size, &code, &code_size, &version)) {
+            binfile_free(&file);
+            ok = false;
+            break;
+        }
+
+        vm_init(&stages[loaded], (uint8_t *)code, code_size, memsize);
+        vm_set_version(&stages[loaded], version);
+        stages[loaded].perf = perf;
+        binfile_free(&file);
+
+        if (decode) {
+            vm_t *vm = &stages[loaded];
+            ok = cache_dir ? cache_get(cache_dir, vm->memory, vm->code_size, vm->version, &progs[loaded])
+                           : decode_program(&progs[loaded], vm->memory, vm->code_size, vm->version);
+            vm->program = &progs[loaded];
+        }
+    }
+
+    ok = ok && channel_pipeline(stages, count);
+
+    int status = 0;
+    for (size_t i = 0; i < loaded; i++) {
+        if (vm_status(&stages[i]) != 0) {
+            status = 1;
+        }
+        vm_destroy(&stages[i]);
+        decode_free(&progs[i]);
+    }
+
+    free(stages);
+    free(progs);
+
+    if (!ok) {
+        logger_error("Operation terminated.\n");
+        return 1;
+    }
+
+    return status;
+}
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        printf("Usage: <RVM> [FILE]\n");
+    const char *filename = NULL;
+    const char *cache_dir = NULL;
+    const char *snapshot_path = NULL;
+    const char *restore_path = NULL;
+    const char *serve_path = NULL;
+    const char *submit_path = NULL;
+    const char *key = NULL;
+    uint32_t kind = SERVE_CODE;
+    int workers = 4;
+    const char *pipe_files[MAX_STAGES];
+    struct guest_file files[VM_FILES];
+    size_t num_files = 0;
+    size_t num_pipe = 1;        // Stage 0 is FILE
+    bool decode = false;
+    uint32_t tier = 0;          // Block threshold of --tier, 0 if off
+    bool perf = false;
+    const char *profile_path = NULL;
+    bool metrics = false;
+    struct watch_arg watches[VM_WATCHES];
+    size_t num_watches = 0;
+    bool watch_stop = false;
+    const char *corpus = NULL;  // Inputs of --fuzz
+
+    size_t memsize = 0xffff;    // Set VM memory size
+    bool memsize_set = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--decode") == 0) {
+            decode = true;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+            decode = true;
+        } else if (strcmp(argv[i], "--tier") == 0 && i + 1 < argc) {
+            tier = (uint32_t)strtoul(argv[++i], NULL, 0);
+            if (tier == 0) tier = TIER_THRESHOLD;
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            restore_path = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--submit") == 0 && i + 1 < argc) {
+            submit_path = argv[++i];
+        } else if (strcmp(argv[i], "--by-path") == 0) {
+            kind = SERVE_PATH;
+        } else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
+            key = argv[++i];
+            kind = SERVE_KEY;
+        } else if ((strcmp(argv[i], "--read") == 0 || strcmp(argv[i], "--write") == 0) &&
+                   i + 1 < argc && num_files < VM_FILES - 3) {
+            files[num_files].write = strcmp(argv[i], "--write") == 0;
+            files[num_files++].path = argv[++i];
+        } else if (strcmp(argv[i], "--pipe") == 0 && i + 1 < argc && num_pipe < MAX_STAGES) {
+            pipe_files[num_pipe++] = argv[++i];
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            perf = true;
+        } else if (strcmp(argv[i], "--metrics") == 0) {
+            metrics = true;
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_path = argv[++i];
+        } else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc && num_watches < VM_WATCHES &&
+                   parse_watch(argv[i + 1], &watches[num_watches])) {
+            num_watches++;
+            i++;
+        } else if (strcmp(argv[i], "--watch-stop") == 0) {
+            watch_stop = true;
+        } else if (strcmp(argv[i], "--fuzz") == 0 && i + 1 < argc) {
+            corpus = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            usage();
+            return 1;
+        } else if (filename == NULL) {
+            filename = argv[i];
+        } else {
+            /* Get memory size from argv */
+            memsize = strtoul(argv[i], NULL, 0);
+            if (memsize == 0) {
+                memsize = 0xffff;
+            }
+            memsize_set = true;
+        }
+    }
+
+    /* The map is written as functions are first entered, perf reads it at report time */
+    if (perf && !submit_path && (serve_path || filename || restore_path) && !perf_open()) {
+        return 1;
+    }
+
+    /* Removed at exit, a killed process leaves it for rvm-top to report as gone */
+    if (metrics && !submit_path && (serve_path || filename || restore_path) && !metrics_open()) {
+        return 1;
+    }
+
+    if (serve_path) {
+        /* Numbers are taken as MEMSIZE, no program is loaded */
+        if (filename) {
+            memsize = strtoul(filename, NULL, 0);
+            if (memsize == 0) {
+                memsize = 0xffff;
+            }
+        }
+
+        serve_options_t options = {
+            .socket_path = serve_path,
+            .cache_dir = cache_dir,
+            .decode = decode,
+            .workers = workers,
+            .memory_size = memsize,
+            .perf = perf,
+        };
+
+        logger_set_verbose(false);
+        return serve_run(&options);
+    }
+
+    if (submit_path) {
+        if (key) {
+            filename = key;
+        } else if (filename == NULL) {
+            usage();
+            return 1;
+        }
+
+        return serve_submit(submit_path, kind, filename, memsize_set ? memsize : 0);
+    }
+
+    if (filename == NULL && restore_path == NULL) {
+        usage();
         return 0;
     }
-    
-    size_t memsize = 0xffff;    // Set VM memory size
 
-    /* Get memory size from argv */
-    if (argc >= 3) {
-        memsize = strtoul(argv[2], NULL, 0);
-        if (memsize == 0) {
-            memsize = 0xffff;
+    if (corpus) {
+        if (filename == NULL) {
+            usage();
+            return 1;
         }
+
+        fuzz_options_t options = {
+            .program = filename,
+            .corpus = corpus,
+            .memory_size = memsize,
+            .decode = decode || tier,
+        };
+
+        return fuzz_run(&options);
+    }
+
+    if (profile_path && !sample_start(SAMPLE_RATE)) {
+        return 1;
+    }
+
+    if (num_pipe > 1 && filename) {
+        pipe_files[0] = filename;
+        int status = run_pipeline(pipe_files, num_pipe, memsize, decode, cache_dir, perf);
+        if (profile_path) {
+            sample_stop(profile_path);
+        }
+        metrics_close();
+        return status;
     }
 
     clock_t start = 0, finish = 0;
     start = clock();    // Get current time
 
-    binfile_t fstruct = binfile_get(argv[1]);   // Get byte code
+    vm_t vm;
+    binfile_t fstruct = { .buffer = NULL, .file_size = 0 };
+
+    if (restore_path) {
+        if (!snapshot_restore(&vm, restore_path)) {
+            logger_error("Operation terminated.\n");
+            return 1;
+        }
+    } else {
+        fstruct = binfile_get(filename);   // Get byte code
+
+        if (fstruct.buffer == NULL) {
+            logger_error("Operation terminated.\n");
+            return 1;
+        }
+
+        #if defined(_WIN32)
+            printf("File size: %lld bytes\n", fstruct.file_size);
+        #else
+            printf("File size: %ld bytes\n", fstruct.file_size);
+        #endif
+
+        printf("Hex dump:\n");      // Print byte code
+        for (size_t i = 0; i < fstruct.file_size; i++) {
+            printf("%02x ", fstruct.buffer[i]);
+            if ((i + 1) % 16 == 0) printf("\n");
+        }
+        printf("\n");
+
+        const uint8_t *code;
+        size_t code_size;
+        uint32_t version;
+        if (!bytecode_code(fstruct.buffer, fstruct.file_size, &code, &code_size, &version)) {
+            logger_error("Operation terminated.\n");
+            return 1;
+        }
 
-    if (fstruct.buffer == NULL) {
+        vm_init(&vm, (uint8_t *)code, code_size, memsize);       // Create VM
+        vm_set_version(&vm, version);
+    }
+
+    vm.snapshot_path = snapshot_path;
+    vm.perf = perf;
+
+    if (!open_files(&vm, files, num_files)) {
         logger_error("Operation terminated.\n");
         return 1;
     }
 
-    #if defined(_WIN32)
-        printf("File size: %lld bytes\n", fstruct.file_size);
-    #else
-        printf("File size: %ld bytes\n", fstruct.file_size);
-    #endif
+    for (size_t i = 0; i < num_watches; i++) {
+        if (!vm_watch(&vm, watches[i].addr, watches[i].size, watch_stop)) {
+            logger_error("Operation terminated.\n");
+            return 1;
+        }
+    }
+
+    if (tier) {
+        vm_run_tiered(&vm, tier, cache_dir);
+    } else if (decode) {
+        /* Code is taken from memory, a restored VM has no program file */
+        decoded_program_t prog;
+        bool ok = cache_dir ? cache_get(cache_dir, vm.memory, vm.code_size, vm.version, &prog)
+                            : decode_program(&prog, vm.memory, vm.code_size, vm.version);
 
-    printf("Hex dump:\n");      // Print byte code
-    for (size_t i = 0; i < fstruct.file_size; i++) {
-        printf("%02x ", fstruct.buffer[i]);
-        if ((i + 1) % 16 == 0) printf("\n");
+        if (!ok) {
+            logger_error("Operation terminated.\n");
+            return 1;
+        }
+
+        vm_run_decoded(&vm, &prog);
+        decode_free(&prog);
+    } else {
+        vm_run(&vm);
     }
-    printf("\n");
 
-    vm_t vm;
-    vm_init(&vm, fstruct.buffer, fstruct.file_size, memsize);       // Create VM
-    vm_run(&vm);
+    uint64_t instructions = vm.counters[VM_COUNTER_INSTRUCTIONS];
+
+    if (profile_path) {
+        sample_stop(profile_path);
+    }
+    metrics_close();
 
-    free(vm.memory);
+    close_files(&vm);
+    vm_destroy(&vm);
     binfile_free(&fstruct);
 
     finish = clock();
 
     double total_time = (double)(finish - start) / CLOCKS_PER_SEC;  // Get total time usage
+    printf("Instructions: %llu\n", (unsigned long long)instructions);
     printf("Total time: %f seconds\n", total_time);
 
     return 0;
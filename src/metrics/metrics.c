@@ -0,0 +1,212 @@
+/* 
+ *
+ *      metrics.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+#include "logger.h"
+#include "vm.h"
+#include "trap.h"
+#include "metrics.h"
+
+#define STORE(field, value)     atomic_store_explicit(&(field), (value), memory_order_relaxed)
+#define LOAD(field)             atomic_load_explicit(&(field), memory_order_relaxed)
+
+#if defined(_WIN32)
+
+bool metrics_open(void) {
+    logger_error("Metrics are not supported on this platform\n");
+    return false;
+}
+
+void metrics_close(void) {
+}
+
+#else
+
+static metrics_segment_t *metrics;     // NULL unless metrics_open() succeeded
+static char metrics_name[64];
+
+/* Create the segment of this process, read by rvm-top */
+bool metrics_open(void) {
+    snprintf(metrics_name, sizeof(metrics_name), METRICS_NAME, (long)getpid());
+
+    int fd = shm_open(metrics_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        logger_error("Failed to create shared memory %s\n", metrics_name);
+        return false;
+    }
+
+    void *segment = MAP_FAILED;
+    if (ftruncate(fd, sizeof(metrics_segment_t)) == 0) {
+        segment = mmap(NULL, sizeof(metrics_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (segment == MAP_FAILED) {
+        logger_error("Failed to map shared memory %s\n", metrics_name);
+        shm_unlink(metrics_name);
+        return false;
+    }
+
+    metrics = (metrics_segment_t *)segment;
+    metrics->version = METRICS_VERSION;
+    metrics->slots = METRICS_SLOTS;
+    metrics->pid = (uint64_t)getpid();
+    atomic_thread_fence(memory_order_release);
+    memcpy(metrics->magic, METRICS_MAGIC, sizeof(metrics->magic));
+
+    return true;
+}
+
+/* Remove the segment, called once no VM runs */
+void metrics_close(void) {
+    if (metrics == NULL) {
+        return;
+    }
+
+    munmap(metrics, sizeof(metrics_segment_t));
+    shm_unlink(metrics_name);
+    metrics = NULL;
+}
+
+/* Resident bytes of guest memory, pages never touched are not counted */
+static size_t metrics_resident(vm_t *vm) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)vm->memory & ~(uintptr_t)(page - 1);
+    uintptr_t end = (uintptr_t)vm->memory + vm->memory_size;
+    size_t resident = 0;
+    unsigned char vec[256];
+
+    for (uintptr_t addr = start; addr < end; addr += sizeof(vec) * page) {
+        size_t length = end - addr;
+        if (length > sizeof(vec) * page) {
+            length = sizeof(vec) * page;
+        }
+        if (mincore((void *)addr, length, vec) != 0) {
+            return vm->memory_size;
+        }
+        for (size_t i = 0; i < (length + page - 1) / page; i++) {
+            resident += (vec[i] & 1) ? page : 0;
+        }
+    }
+
+    return (resident < vm->memory_size) ? resident : vm->memory_size;
+}
+
+#endif
+
+/* Give the VM a slot when metrics are on, called by the engines as they start */
+void metrics_attach(vm_t *vm) {
+    vm->metrics = NULL;
+
+    #if !defined(_WIN32)
+        if (metrics == NULL) {
+            return;
+        }
+
+        for (size_t i = 0; i < METRICS_SLOTS; i++) {
+            metrics_slot_t *slot = &metrics->slot[i];
+            uint32_t state = METRICS_FREE;
+
+            if (atomic_compare_exchange_strong(&slot->state, &state, METRICS_RUNNING)) {
+                uint64_t now = trap_clock_ns();
+
+                for (size_t t = 0; t < METRICS_TRAPS; t++) {
+                    STORE(slot->traps[t], 0);
+                }
+                STORE(slot->thread_id, (uint32_t)vm->thread_id);
+                STORE(slot->started_ns, now);
+                STORE(slot->io_ns, 0);
+                STORE(slot->ips, 0);
+                STORE(slot->memory_size, vm->memory_size);
+                STORE(slot->memory_peak, 0);
+                slot->period_ns = now;
+                slot->period_instructions = vm->counters[VM_COUNTER_INSTRUCTIONS];
+
+                vm->metrics = slot;
+                metrics_publish(vm);
+                return;
+            }
+        }
+    #endif
+}
+
+/* Publish the final counters and give the slot back */
+void metrics_detach(vm_t *vm) {
+    metrics_slot_t *slot = vm->metrics;
+    if (slot == NULL) {
+        return;
+    }
+
+    metrics_publish(vm);
+    vm->metrics = NULL;
+    atomic_store_explicit(&slot->state, METRICS_FREE, memory_order_release);
+}
+
+/* Copy the counters of the VM to its slot. Called every METRICS_INTERVAL
+ * instructions, rates and memory are refreshed once per period */
+void metrics_publish(vm_t *vm) {
+    metrics_slot_t *slot = vm->metrics;
+    uint64_t instructions = vm->counters[VM_COUNTER_INSTRUCTIONS];
+    uint64_t now = trap_clock_ns();
+
+    STORE(slot->pc, vm->pc);
+    STORE(slot->instructions, instructions);
+    STORE(slot->branches, vm->counters[VM_COUNTER_BRANCHES]);
+    STORE(slot->memory_ops, vm->counters[VM_COUNTER_MEMORY]);
+    STORE(slot->updated_ns, now);
+
+    if (now - slot->period_ns >= METRICS_PERIOD_NS) {
+        uint64_t elapsed = now - slot->period_ns;
+        STORE(slot->ips, (instructions - slot->period_instructions) * 1000000000ULL / elapsed);
+        slot->period_ns = now;
+        slot->period_instructions = instructions;
+
+        #if !defined(_WIN32)
+            uint64_t resident = metrics_resident(vm);
+            if (resident > LOAD(slot->memory_peak)) {
+                STORE(slot->memory_peak, resident);
+            }
+        #endif
+    }
+}
+
+/* Count a trap and the time spent in it when it does I/O */
+void metrics_trap(vm_t *vm, size_t trap_number, uint64_t ns) {
+    metrics_slot_t *slot = vm->metrics;
+    size_t index = (trap_number < METRICS_TRAPS) ? trap_number : METRICS_TRAPS - 1;
+
+    STORE(slot->traps[index], LOAD(slot->traps[index]) + 1);
+
+    switch (trap_number) {
+        case TRAP_PUTC:
+        case TRAP_GETC:
+        case TRAP_SEND:
+        case TRAP_RECV:
+        case TRAP_READ:
+        case TRAP_WRITE:
+        case TRAP_WRITEV: STORE(slot->io_ns, LOAD(slot->io_ns) + ns); break;
+
+        default: break;
+    }
+}
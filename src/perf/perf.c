@@ -0,0 +1,217 @@
+/* 
+ *
+ *      perf.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+    #include <pthread.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #define PERF_SUPPORTED 1
+#endif
+
+#include "logger.h"
+#include "vm.h"
+#include "perf.h"
+
+#if defined(PERF_SUPPORTED)
+
+/* Native stub entered once per guest call: keeps a frame pointer so perf can
+ * unwind through it, then calls frame(vm, arg). All trampolines are the same
+ * code, perf tells them apart by address through /tmp/perf-<pid>.map */
+#if defined(__x86_64__)
+static const uint8_t perf_stub[] = {
+    0x55,                   // push %rbp
+    0x48, 0x89, 0xe5,       // mov %rsp, %rbp
+    0xff, 0xd2,             // call *%rdx
+    0x5d,                   // pop %rbp
+    0xc3,                   // ret
+};
+#else
+static const uint32_t perf_stub[] = {
+    0xa9bf7bfd,             // stp x29, x30, [sp, #-16]!
+    0x910003fd,             // mov x29, sp
+    0xd63f0040,             // blr x2
+    0xa8c17bfd,             // ldp x29, x30, [sp], #16
+    0xd65f03c0,             // ret
+};
+#endif
+
+typedef void (*perf_trampoline_fn)(vm_t *vm, void *arg, perf_frame_fn frame);
+
+/* Trampoline of a guest function, in an open addressing table keyed by entry */
+struct perf_entry {
+    size_t pc;
+    perf_trampoline_fn trampoline;      // NULL for a free slot
+};
+
+static struct {
+    pthread_mutex_t lock;
+    FILE *map;                          // /tmp/perf-<pid>.map
+    struct perf_entry *table;
+    size_t mask;
+    size_t count;
+
+    uint8_t *chunk;                     // Trampolines not handed out yet
+    size_t chunk_left;
+} perf = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Fill a chunk with copies of the stub, then make it executable */
+static bool perf_chunk(void) {
+    uint8_t *chunk = (uint8_t *)mmap(NULL, PERF_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED) {
+        return false;
+    }
+
+    for (size_t offset = 0; offset < PERF_CHUNK_SIZE; offset += PERF_TRAMPOLINE_SIZE) {
+        memcpy(chunk + offset, perf_stub, sizeof(perf_stub));
+    }
+
+    if (mprotect(chunk, PERF_CHUNK_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        munmap(chunk, PERF_CHUNK_SIZE);
+        return false;
+    }
+    __builtin___clear_cache((char *)chunk, (char *)chunk + PERF_CHUNK_SIZE);
+
+    perf.chunk = chunk;
+    perf.chunk_left = PERF_CHUNK_SIZE / PERF_TRAMPOLINE_SIZE;
+
+    return true;
+}
+
+static bool perf_grow(void) {
+    size_t size = perf.table ? (perf.mask + 1) * 2 : 256;
+    struct perf_entry *table = (struct perf_entry *)calloc(size, sizeof(struct perf_entry));
+    if (table == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; perf.table && i <= perf.mask; i++) {
+        if (perf.table[i].trampoline) {
+            size_t slot = perf.table[i].pc & (size - 1);
+            while (table[slot].trampoline) {
+                slot = (slot + 1) & (size - 1);
+            }
+            table[slot] = perf.table[i];
+        }
+    }
+
+    free(perf.table);
+    perf.table = table;
+    perf.mask = size - 1;
+
+    return true;
+}
+
+/* Trampoline of the guest function at pc, made and named on first use */
+static perf_trampoline_fn perf_trampoline(size_t pc) {
+    perf_trampoline_fn trampoline = NULL;
+
+    pthread_mutex_lock(&perf.lock);
+
+    if (perf.map == NULL || ((perf.count + 1) * 2 > perf.mask + 1 && !perf_grow())) {
+        pthread_mutex_unlock(&perf.lock);
+        return NULL;
+    }
+
+    size_t slot = pc & perf.mask;
+    while (perf.table[slot].trampoline && perf.table[slot].pc != pc) {
+        slot = (slot + 1) & perf.mask;
+    }
+
+    if (perf.table[slot].trampoline) {
+        trampoline = perf.table[slot].trampoline;
+    } else if (perf.chunk_left > 0 || perf_chunk()) {
+        uint8_t *code = perf.chunk;
+        perf.chunk += PERF_TRAMPOLINE_SIZE;
+        perf.chunk_left--;
+
+        /* Cast through a data pointer, ISO C has no function to object conversion */
+        memcpy(&trampoline, &code, sizeof(trampoline));
+        perf.table[slot].pc = pc;
+        perf.table[slot].trampoline = trampoline;
+        perf.count++;
+
+        if (pc == 0) {
+            fprintf(perf.map, "%zx %x rvm:main\n", (size_t)code, PERF_TRAMPOLINE_SIZE);
+        } else {
+            fprintf(perf.map, "%zx %x rvm:sub_%zx\n", (size_t)code, PERF_TRAMPOLINE_SIZE, pc);
+        }
+        fflush(perf.map);
+    }
+
+    pthread_mutex_unlock(&perf.lock);
+
+    return trampoline;
+}
+
+/* Start writing /tmp/perf-<pid>.map for VMs run with their perf field set */
+bool perf_open(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+
+    pthread_mutex_lock(&perf.lock);
+    if (perf.map == NULL) {
+        perf.map = fopen(path, "w");
+    }
+    pthread_mutex_unlock(&perf.lock);
+
+    if (perf.map == NULL) {
+        logger_error("Failed to create %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+/* Stop naming new functions. Trampolines stay, VMs may still be running on them */
+void perf_close(void) {
+    pthread_mutex_lock(&perf.lock);
+    if (perf.map) {
+        fclose(perf.map);
+        perf.map = NULL;
+    }
+    pthread_mutex_unlock(&perf.lock);
+}
+
+/* Run the guest function at vm->pc through its trampoline, so host samples
+ * taken in frame are attributed to it and its callers in perf report */
+void perf_call(vm_t *vm, perf_frame_fn frame, void *arg) {
+    perf_trampoline_fn trampoline = perf_trampoline(vm->pc);
+
+    if (trampoline) {
+        trampoline(vm, arg, frame);
+    } else {
+        frame(vm, arg);
+    }
+}
+
+#else
+
+bool perf_open(void) {
+    logger_error("perf maps are not supported on this platform\n");
+    return false;
+}
+
+void perf_close(void) {
+}
+
+void perf_call(vm_t *vm, perf_frame_fn frame, void *arg) {
+    frame(vm, arg);
+}
+
+#endif
@@ -0,0 +1,213 @@
+/* 
+ *
+ *      sample.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if !defined(_WIN32)
+    #include <signal.h>
+    #include <sys/time.h>
+#endif
+
+#include "instruction.h"
+#include "logger.h"
+#include "vm.h"
+#include "sample.h"
+
+/* VM run by the current thread, read by the signal handler */
+static _Thread_local vm_t *volatile sample_vm;
+
+/* Run the VM on this thread under the profiler, NULL when it stops */
+void sample_attach(vm_t *vm) {
+    sample_vm = vm;
+}
+
+#if defined(_WIN32)
+
+bool sample_start(unsigned rate) {
+    (void)rate;
+    logger_error("Sampling is not supported on this platform\n");
+    return false;
+}
+
+bool sample_stop(const char *path) {
+    (void)path;
+    return false;
+}
+
+#else
+
+/* Guest call stack at a sample, outermost first. Frames before the last
+ * are return addresses from the shadow stack, the last one is the instruction being run */
+struct sample_record {
+    uint32_t depth;
+    uint8_t opcode;             // Instruction at the pc
+    bool truncated;             // Outer frames were not kept
+    size_t frames[SAMPLE_DEPTH];
+};
+
+typedef struct sample_record sample_record_t;
+
+static struct {
+    sample_record_t *records;   // Written once each, claimed by the handler with next
+    _Atomic size_t next;
+    _Atomic size_t dropped;
+    _Atomic bool active;
+    struct sigaction previous;
+} sample;
+
+static void sample_handler(int sig) {
+    (void)sig;
+
+    vm_t *vm = sample_vm;
+    if (vm == NULL || !atomic_load_explicit(&sample.active, memory_order_relaxed)) {
+        return;
+    }
+
+    size_t index = atomic_fetch_add_explicit(&sample.next, 1, memory_order_relaxed);
+    if (index >= SAMPLE_CAPACITY) {
+        atomic_fetch_add_explicit(&sample.dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    sample_record_t *record = &sample.records[index];
+    size_t pc = vm->insn_pc;
+    size_t calls = (vm->ras_depth < VM_RAS_DEPTH) ? vm->ras_depth : VM_RAS_DEPTH;
+    size_t first = (calls > SAMPLE_DEPTH - 1) ? calls - (SAMPLE_DEPTH - 1) : 0;
+
+    for (size_t i = first; i < calls; i++) {
+        record->frames[record->depth++] = vm->ras[i];
+    }
+    record->frames[record->depth++] = pc;
+    record->opcode = (pc < vm->memory_size) ? vm->memory[pc] : OP_COUNT;
+    record->truncated = first > 0 || vm->ras_depth > VM_RAS_DEPTH;
+}
+
+/* Sample the VMs attached on any thread rate times per second of CPU time */
+bool sample_start(unsigned rate) {
+    if (rate == 0 || rate > 1000000) {
+        logger_error("Invalid sampling rate %u\n", rate);
+        return false;
+    }
+
+    sample.records = (sample_record_t *)calloc(SAMPLE_CAPACITY, sizeof(sample_record_t));
+    if (sample.records == NULL) {
+        logger_error("Failed to allocate samples\n");
+        return false;
+    }
+    atomic_store(&sample.next, 0);
+    atomic_store(&sample.dropped, 0);
+    atomic_store(&sample.active, true);
+
+    /* Restart system calls, guest I/O traps must not see EINTR */
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sample_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / rate;
+    timer.it_value = timer.it_interval;
+
+    if (sigaction(SIGPROF, &action, &sample.previous) != 0 || setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        logger_error("Failed to start sampling\n");
+        free(sample.records);
+        sample.records = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static int sample_compare(const void *a, const void *b) {
+    const sample_record_t *x = (const sample_record_t *)a;
+    const sample_record_t *y = (const sample_record_t *)b;
+
+    if (x->depth != y->depth) return (x->depth < y->depth) ? -1 : 1;
+    if (x->truncated != y->truncated) return x->truncated ? 1 : -1;
+    if (x->opcode != y->opcode) return (x->opcode < y->opcode) ? -1 : 1;
+    return memcmp(x->frames, y->frames, x->depth * sizeof(size_t));
+}
+
+/* Name a frame by address and instruction, the caller frames are CALLs */
+static void sample_frame(FILE *fp, size_t addr, uint8_t opcode) {
+    const char *mnemonic = (opcode < OP_COUNT && instruction_table[opcode].mnemonic)
+                         ? instruction_table[opcode].mnemonic : "?";
+    fprintf(fp, "0x%04zx:%s", addr, mnemonic);
+}
+
+/* Stop sampling and write the samples to path as folded stacks, one line
+ * per distinct stack followed by its count, as read by flamegraph.pl */
+bool sample_stop(const char *path) {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    atomic_store(&sample.active, false);
+    sigaction(SIGPROF, &sample.previous, NULL);
+
+    if (sample.records == NULL) {
+        return false;
+    }
+
+    size_t count = atomic_load(&sample.next);
+    if (count > SAMPLE_CAPACITY) {
+        count = SAMPLE_CAPACITY;
+    }
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        logger_error("Failed to create %s\n", path);
+        free(sample.records);
+        sample.records = NULL;
+        return false;
+    }
+
+    qsort(sample.records, count, sizeof(sample_record_t), sample_compare);
+
+    size_t call_length = instruction_length(OP_CALL);
+    for (size_t i = 0; i < count; ) {
+        const sample_record_t *record = &sample.records[i];
+        size_t same = 1;
+        while (i + same < count && sample_compare(record, &sample.records[i + same]) == 0) {
+            same++;
+        }
+
+        fprintf(fp, record->truncated ? "rvm;...;" : "rvm;");
+        for (uint32_t f = 0; f + 1 < record->depth; f++) {
+            sample_frame(fp, record->frames[f] - call_length, OP_CALL);
+            fputc(';', fp);
+        }
+        sample_frame(fp, record->frames[record->depth - 1], record->opcode);
+        fprintf(fp, " %zu\n", same);
+
+        i += same;
+    }
+
+    size_t dropped = atomic_load(&sample.dropped);
+    if (dropped > 0) {
+        logger_error("%zu samples dropped, the buffer holds %d\n", dropped, SAMPLE_CAPACITY);
+    }
+
+    fclose(fp);
+    free(sample.records);
+    sample.records = NULL;
+
+    return true;
+}
+
+#endif
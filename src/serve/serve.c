@@ -0,0 +1,411 @@
+/* 
+ *
+ *      serve.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+    #include <errno.h>
+    #include <signal.h>
+    #include <pthread.h>
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+#endif
+
+#include "logger.h"
+#include "bytecode.h"
+#include "vmem.h"
+#include "vm.h"
+#include "decode.h"
+#include "cache.h"
+#include "thread.h"
+#include "serve.h"
+
+#if defined(_WIN32)
+
+int serve_run(const serve_options_t *options) {
+    (void)options;
+    logger_error("Serving is not supported on this platform\n");
+    return 1;
+}
+
+int serve_submit(const char *socket_path, uint32_t kind, const char *program, size_t memsize) {
+    (void)socket_path; (void)kind; (void)program; (void)memsize;
+    logger_error("Serving is not supported on this platform\n");
+    return 1;
+}
+
+#else
+
+/* Worker thread, owns a memory arena reused by all of its jobs */
+struct serve_worker {
+    pthread_t thread;
+    int listen_fd;
+    const serve_options_t *options;
+
+    uint8_t *arena;             // Guest memory
+    uint8_t *buffer;            // Program and input of the current job
+    size_t buffer_size;
+};
+
+typedef struct serve_worker serve_worker_t;
+
+static bool read_full(int fd, void *data, size_t size) {
+    uint8_t *p = (uint8_t *)data;
+
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool write_full(int fd, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool send_frame(int fd, uint32_t type, const void *data, size_t size) {
+    serve_frame_t frame = { .type = type, .size = (uint32_t)size };
+    return write_full(fd, &frame, sizeof(frame)) && write_full(fd, data, size);
+}
+
+/* Send guest output in frames followed by the exit status */
+static void send_reply(int fd, const char *output, size_t size, int32_t status) {
+    for (size_t offset = 0; offset < size; offset += SERVE_CHUNK) {
+        size_t chunk = (size - offset < SERVE_CHUNK) ? size - offset : SERVE_CHUNK;
+        if (!send_frame(fd, SERVE_OUTPUT, output + offset, chunk)) {
+            return;
+        }
+    }
+
+    send_frame(fd, SERVE_EXIT, &status, sizeof(status));
+}
+
+/* Run one job on the worker's arena */
+static void serve_job(serve_worker_t *worker, int fd) {
+    const serve_options_t *options = worker->options;
+    serve_request_t request;
+
+    if (!read_full(fd, &request, sizeof(request)) ||
+        memcmp(request.magic, SERVE_MAGIC, sizeof(request.magic)) != 0 ||
+        request.program_size > SERVE_MAX_PROGRAM || request.input_size > SERVE_MAX_INPUT) {
+        send_reply(fd, NULL, 0, SERVE_BAD_REQUEST);
+        return;
+    }
+
+    size_t size = request.program_size + request.input_size + 1;
+    if (size > worker->buffer_size) {
+        uint8_t *buffer = (uint8_t *)realloc(worker->buffer, size);
+        if (buffer == NULL) {
+            send_reply(fd, NULL, 0, SERVE_BAD_REQUEST);
+            return;
+        }
+        worker->buffer = buffer;
+        worker->buffer_size = size;
+    }
+
+    if (!read_full(fd, worker->buffer, request.program_size + request.input_size)) {
+        return;
+    }
+
+    uint8_t *program = worker->buffer;
+    uint8_t *input = worker->buffer + request.program_size;
+
+    /* Get byte code */
+    const uint8_t *code = program;
+    size_t code_size = request.program_size;
+    binfile_t file = { .buffer = NULL, .file_size = 0 };
+    decoded_program_t prog;
+    bool decoded = false;
+    uint32_t version = 0;
+
+    memset(&prog, 0, sizeof(prog));
+
+    if (request.kind == SERVE_PATH) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%.*s", (int)request.program_size, (const char *)program);
+
+        file = binfile_get(path);
+        code = file.buffer;
+        code_size = file.file_size;
+    } else if (request.kind == SERVE_KEY) {
+        uint64_t key = 0;
+        if (request.program_size == sizeof(key) && options->cache_dir) {
+            memcpy(&key, program, sizeof(key));
+            decoded = cache_load_key(options->cache_dir, key, &prog, &code);
+        }
+        code_size = decoded ? prog.code_size : 0;
+        version = prog.version;
+        if (!decoded) code = NULL;
+    } else if (request.kind != SERVE_CODE) {
+        code = NULL;
+    }
+
+    /* Cached programs are stored without their header */
+    if (code && !decoded && !bytecode_code(code, code_size, &code, &code_size, &version)) {
+        code = NULL;
+    }
+
+    size_t memsize = request.memory_size ? request.memory_size : options->memory_size;
+
+    if (code == NULL || memsize > options->memory_size || code_size > memsize) {
+        decode_free(&prog);
+        binfile_free(&file);
+        send_reply(fd, NULL, 0, SERVE_BAD_REQUEST);
+        return;
+    }
+
+    if (!decoded && options->decode) {
+        decoded = options->cache_dir ? cache_get(options->cache_dir, code, code_size, version, &prog)
+                                     : decode_program(&prog, code, code_size, version);
+    }
+
+    /* The arena past the job memory becomes guard pages, as in a memory of its own */
+    size_t job_size = vmem_round(memsize);
+    size_t tail = vmem_round(options->memory_size) - job_size;
+    vmem_protect(worker->arena + job_size, tail, VMEM_NONE);
+
+    /* Run */
+    vm_t vm;
+    vm_init_memory(&vm, worker->arena, (uint8_t *)code, code_size, memsize);
+    vm_set_version(&vm, version);
+    vm.perf = options->perf;
+
+    char *output = NULL;
+    size_t output_size = 0;
+    vm.input = request.input_size ? fmemopen(input, request.input_size, "r") : NULL;
+    vm.output = open_memstream(&output, &output_size);
+
+    if (vm.output == NULL) {
+        vm.running = false;
+    } else if (decoded) {
+        vm_run_decoded(&vm, &prog);
+    } else {
+        vm_run(&vm);
+    }
+
+    vm_threads_free(&vm);
+
+    if (vm.input) fclose(vm.input);
+    if (vm.output) fclose(vm.output);
+
+    send_reply(fd, output, output_size, vm_status(&vm) ? SERVE_FAULT : SERVE_OK);
+
+    free(output);
+    decode_free(&prog);
+    binfile_free(&file);
+
+    /* Give pages back, the arena is zero filled again for the next job */
+    vmem_reset(worker->arena, memsize);
+    vmem_protect(worker->arena + job_size, tail, VMEM_WRITE);
+}
+
+static void *serve_worker_main(void *arg) {
+    serve_worker_t *worker = (serve_worker_t *)arg;
+
+    while (1) {
+        int fd = accept(worker->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            logger_error("accept failed: %s\n", strerror(errno));
+            break;
+        }
+
+        serve_job(worker, fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int serve_socket(const char *socket_path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+        logger_error("Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr->sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        logger_error("Failed to create socket: %s\n", strerror(errno));
+    }
+    return fd;
+}
+
+/* Serve jobs on a Unix domain socket until killed */
+int serve_run(const serve_options_t *options) {
+    struct sockaddr_un addr;
+    int listen_fd = serve_socket(options->socket_path, &addr);
+    if (listen_fd < 0) {
+        return 1;
+    }
+
+    unlink(options->socket_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 128) != 0) {
+        logger_error("Failed to listen on %s: %s\n", options->socket_path, strerror(errno));
+        close(listen_fd);
+        return 1;
+    }
+
+    /* A client going away must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    int workers = (options->workers > 0) ? options->workers : 1;
+    serve_worker_t *pool = (serve_worker_t *)calloc(workers, sizeof(serve_worker_t));
+    if (pool == NULL) {
+        logger_error("Failed to allocate workers\n");
+        close(listen_fd);
+        return 1;
+    }
+
+    for (int i = 0; i < workers; i++) {
+        pool[i].listen_fd = listen_fd;
+        pool[i].options = options;
+        pool[i].arena = vmem_alloc(options->memory_size);
+
+        if (pool[i].arena == NULL || pthread_create(&pool[i].thread, NULL, serve_worker_main, &pool[i]) != 0) {
+            logger_error("Failed to start worker %d\n", i);
+            exit(1);
+        }
+    }
+
+    fprintf(stderr, "Serving on %s with %d workers\n", options->socket_path, workers);
+
+    for (int i = 0; i < workers; i++) {
+        pthread_join(pool[i].thread, NULL);
+    }
+
+    close(listen_fd);
+    unlink(options->socket_path);
+    return 0;
+}
+
+/* Read all of a stream */
+static uint8_t *read_stream(FILE *fp, size_t *size) {
+    size_t capacity = 4096;
+    uint8_t *data = (uint8_t *)malloc(capacity);
+    *size = 0;
+
+    while (data != NULL) {
+        size_t n = fread(data + *size, 1, capacity - *size, fp);
+        *size += n;
+        if (n == 0) break;
+
+        if (*size == capacity) {
+            capacity *= 2;
+            uint8_t *grown = (uint8_t *)realloc(data, capacity);
+            if (grown == NULL) free(data);
+            data = grown;
+        }
+    }
+
+    return data;
+}
+
+/* Submit a job, copy its output to stdout and return its exit status.
+ * Guest input is read from stdin unless it is a terminal */
+int serve_submit(const char *socket_path, uint32_t kind, const char *program, size_t memsize) {
+    uint8_t *program_data = NULL;
+    size_t program_size = 0;
+    uint64_t key = 0;
+
+    if (kind == SERVE_CODE) {
+        binfile_t file = binfile_get(program);
+        if (file.buffer == NULL) {
+            return SERVE_BAD_REQUEST;
+        }
+        program_data = file.buffer;
+        program_size = file.file_size;
+    } else if (kind == SERVE_KEY) {
+        key = strtoull(program, NULL, 16);
+        program_data = (uint8_t *)malloc(sizeof(key));
+        memcpy(program_data, &key, sizeof(key));
+        program_size = sizeof(key);
+    } else {
+        program_size = strlen(program);
+        program_data = (uint8_t *)malloc(program_size + 1);
+        memcpy(program_data, program, program_size);
+    }
+
+    size_t input_size = 0;
+    uint8_t *input = isatty(STDIN_FILENO) ? NULL : read_stream(stdin, &input_size);
+
+    struct sockaddr_un addr;
+    int fd = serve_socket(socket_path, &addr);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        logger_error("Failed to connect to %s\n", socket_path);
+        free(program_data);
+        free(input);
+        if (fd >= 0) close(fd);
+        return SERVE_BAD_REQUEST;
+    }
+
+    serve_request_t request = {
+        .kind = kind,
+        .memory_size = memsize,
+        .program_size = program_size,
+        .input_size = input_size,
+    };
+    memcpy(request.magic, SERVE_MAGIC, sizeof(request.magic));
+
+    int status = SERVE_BAD_REQUEST;
+    bool ok = write_full(fd, &request, sizeof(request)) &&
+              write_full(fd, program_data, program_size) &&
+              write_full(fd, input, input_size);
+
+    free(program_data);
+    free(input);
+
+    /* Copy output frames until the exit status */
+    serve_frame_t frame;
+    static uint8_t chunk[SERVE_CHUNK];
+    while (ok && read_full(fd, &frame, sizeof(frame)) && frame.size <= SERVE_CHUNK &&
+           read_full(fd, chunk, frame.size)) {
+        if (frame.type == SERVE_EXIT && frame.size == sizeof(int32_t)) {
+            int32_t value;
+            memcpy(&value, chunk, sizeof(value));
+            status = value;
+            break;
+        }
+        fwrite(chunk, 1, frame.size, stdout);
+    }
+
+    fflush(stdout);
+    close(fd);
+
+    return status;
+}
+
+#endif
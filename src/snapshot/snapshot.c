@@ -0,0 +1,217 @@
+/* 
+ *
+ *      snapshot.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "vmem.h"
+#include "vm.h"
+#include "bytecode.h"
+#include "snapshot.h"
+
+/* Check if a page only holds zeros */
+static bool page_is_zero(const uint8_t *page, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (page[i]) return false;
+    }
+    return true;
+}
+
+/* Write VM state and the non-zero pages of its memory */
+bool snapshot_save(const vm_t *vm, const char *path) {
+    size_t page_size = vmem_page_size();
+    size_t total_pages = vmem_round(vm->memory_size) / page_size;
+
+    uint64_t *index = (uint64_t *)malloc(sizeof(uint64_t) * (total_pages + 1));
+    if (index == NULL) {
+        logger_error("Failed to allocate snapshot index\n");
+        return false;
+    }
+
+    uint64_t num_pages = 0;
+    for (size_t page = 0; page < total_pages; page++) {
+        if (!page_is_zero(vm->memory + page * page_size, page_size)) {
+            index[num_pages++] = page;
+        }
+    }
+
+    snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.page_size = page_size;
+    header.num_pages = num_pages;
+    header.data_offset = vmem_round(sizeof(header) + sizeof(uint64_t) * num_pages);
+
+    for (int i = 0; i < VM_REGISTERS; i++) {
+        header.registers[i] = vm->registers[i];
+    }
+    header.pc = vm->pc;
+    header.running = vm->running;
+    header.code_size = vm->code_size;
+    header.memory_size = vm->memory_size;
+    header.sp = vm->sp;
+    header.stack_base = vm->stack_base;
+    header.stack_top = vm->stack_top;
+    header.isa_version = vm->version;
+
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        logger_error("Failed to create snapshot file: %s\n", path);
+        free(index);
+        return false;
+    }
+
+    size_t pad = header.data_offset - sizeof(header) - sizeof(uint64_t) * num_pages;
+    uint8_t *padding = (uint8_t *)calloc(pad + 1, 1);
+
+    bool ok = padding != NULL &&
+              fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(index, sizeof(uint64_t), num_pages, fp) == num_pages &&
+              fwrite(padding, 1, pad, fp) == pad;
+
+    /* Last page may extend past memory_size, guest memory is always page rounded */
+    for (uint64_t i = 0; ok && i < num_pages; i++) {
+        ok = fwrite(vm->memory + index[i] * page_size, 1, page_size, fp) == page_size;
+    }
+
+    free(padding);
+    free(index);
+
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+
+    /* Replace atomically, a crash keeps the previous snapshot. Windows does not replace on rename */
+    #if defined(_WIN32)
+        remove(path);
+    #endif
+    if (!ok || rename(tmp_path, path) != 0) {
+        logger_error("Failed to write snapshot file: %s\n", path);
+        remove(tmp_path);
+        return false;
+    }
+
+    #if defined(_WIN32)
+        logger_print("Snapshot written: %lld pages to %s\n", num_pages, path);
+    #else
+        logger_print("Snapshot written: %ld pages to %s\n", (long)num_pages, path);
+    #endif
+
+    return true;
+}
+
+/* Restore VM state, stored pages are mapped copy-on-write when possible */
+bool snapshot_restore(vm_t *vm, const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        logger_error("Error while opening snapshot: %s\n", path);
+        return false;
+    }
+
+    snapshot_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SNAPSHOT_VERSION || header.page_size == 0 ||
+        header.memory_size == 0 || header.num_pages > header.memory_size / header.page_size + 1 ||
+        header.code_size > header.memory_size || header.stack_top > header.memory_size ||
+        header.stack_base > header.stack_top ||
+        header.isa_version == 0 || header.isa_version > BYTECODE_VERSION) {
+        logger_error("Invalid snapshot file: %s\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    uint64_t *index = (uint64_t *)malloc(sizeof(uint64_t) * (header.num_pages + 1));
+    uint8_t *memory = vmem_alloc(header.memory_size);
+    uint64_t limit = vmem_round(header.memory_size) / header.page_size;    // Pages that fit in memory
+
+    if (index == NULL || memory == NULL ||
+        fread(index, sizeof(uint64_t), header.num_pages, fp) != header.num_pages) {
+        logger_error("Failed to load snapshot: %s\n", path);
+        free(index);
+        vmem_free(memory, header.memory_size);
+        fclose(fp);
+        return false;
+    }
+
+    /* Pages can be mapped directly if they are a multiple of host pages */
+    bool mappable = (header.page_size % vmem_page_size()) == 0;
+    bool ok = true;
+
+    for (uint64_t i = 0; ok && i < header.num_pages; ) {
+        uint64_t page = index[i];
+        uint64_t run = 1;
+
+        /* Compared before multiplying, a crafted index must not wrap around */
+        if (page >= limit) {
+            ok = false;
+            break;
+        }
+
+        /* Map runs of consecutive pages at once */
+        while (i + run < header.num_pages && index[i + run] == page + run && page + run < limit) {
+            run++;
+        }
+
+        uint64_t offset = header.data_offset + i * header.page_size;
+        uint8_t *dest = memory + page * header.page_size;
+        size_t size = run * header.page_size;
+
+        if (!mappable || !vmem_map_file(dest, size, fileno(fp), offset, true)) {
+            ok = fseek(fp, (long)offset, SEEK_SET) == 0 && fread(dest, 1, size, fp) == size;
+        }
+
+        i += run;
+    }
+
+    free(index);
+    fclose(fp);
+
+    if (!ok) {
+        logger_error("Failed to load snapshot pages: %s\n", path);
+        vmem_free(memory, header.memory_size);
+        return false;
+    }
+
+    memset(vm, 0, sizeof(*vm));
+    for (int i = 0; i < VM_REGISTERS; i++) {
+        vm->registers[i] = header.registers[i];
+    }
+    vm->memory = memory;
+    vm->pc = header.pc;
+    vm->insn_pc = header.pc;
+    vm->running = header.running != 0;
+    vm->code_size = header.code_size;
+    vm_set_version(vm, (uint32_t)header.isa_version);
+    vm->memory_size = header.memory_size;
+    vm->memory_mask = vmem_mask(header.memory_size);
+    vm->sp = header.sp;
+    vm->stack_base = header.stack_base;
+    vm->stack_top = header.stack_top;
+    vm->memory_fd = -1;
+    vm->input = stdin;
+    vm->output = stdout;
+
+    for (int i = 0; i < VM_FILES; i++) {
+        vm->files[i] = -1;
+    }
+
+    return true;
+}
@@ -0,0 +1,113 @@
+/* 
+ *
+ *      tier.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "vm.h"
+#include "decode.h"
+#include "cache.h"
+#include "thread.h"
+#include "sample.h"
+#include "metrics.h"
+#include "guard.h"
+#include "tier.h"
+
+/* Interpret until a block entered by a taken branch reaches threshold, true if one did */
+static bool tier_loop(vm_t *vm, uint32_t *heat, uint32_t threshold) {
+    while (vm->running && vm->pc < vm->code_size) {
+        uint64_t branches = vm->counters[VM_COUNTER_BRANCHES];
+
+        vm_execute(vm);
+
+        /* A taken branch starts a block, loop headers are the ones getting hot */
+        if (vm->counters[VM_COUNTER_BRANCHES] != branches && vm->pc < vm->code_size &&
+            ++heat[vm->pc] >= threshold) {
+            return vm->running;
+        }
+    }
+
+    return false;
+}
+
+/* Interpret, counting entries of every basic block, until one reaches threshold.
+ * True if the VM is still running and should move to the decoded engine */
+static bool tier_interpret(vm_t *vm, uint32_t threshold) {
+    uint32_t *heat = (uint32_t *)calloc(vm->code_size ? vm->code_size : 1, sizeof(uint32_t));
+    if (heat == NULL) {
+        logger_error("Failed to allocate block counters\n");
+        vm->running = false;
+        return false;
+    }
+
+    bool hot = false;
+
+    vm_guard_t guard;
+    vm_guard_enter(vm, &guard);
+    if (VM_GUARD_TRY(&guard)) {
+        hot = tier_loop(vm, heat, threshold);
+    } else {
+        vm_guard_fault(&guard);
+    }
+    vm_guard_leave(&guard);
+
+    free(heat);
+
+    return hot;
+}
+
+/* Run VM in the interpreter, switching to the decoded engine in the middle of the run
+ * once a block got hot. Short programs never pay for decoding. With perf trampolines
+ * the whole run stays on the decoded engine */
+void vm_run_tiered(vm_t *vm, uint32_t threshold, const char *cache_dir) {
+    logger_print("Starting VM execution...\n");
+
+    bool hot = true;
+
+    if (!vm->perf && threshold > 0) {
+        vm_schedule(vm);
+        sample_attach(vm);
+        metrics_attach(vm);
+        hot = tier_interpret(vm, threshold);
+        metrics_detach(vm);
+        sample_attach(NULL);
+    }
+
+    if (hot) {
+        /* Code is decoded from memory, so writes to it made so far are seen */
+        decoded_program_t prog;
+        bool ok = cache_dir ? cache_get(cache_dir, vm->memory, vm->code_size, vm->version, &prog)
+                            : decode_program(&prog, vm->memory, vm->code_size, vm->version);
+
+        if (!ok) {
+            vm->running = false;
+            return;
+        }
+
+        logger_print("Block at position %zu is hot, moving to the decoded engine\n", vm->pc);
+        vm_enter_decoded(vm, &prog);
+        decode_free(&prog);
+        return;
+    }
+
+    if (vm->running) {
+        logger_print("VM execution completed\n");
+    }
+
+    if (vm->thread_id == 0) {
+        vm_join_all(vm);
+    }
+}
@@ -14,42 +14,540 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef _WIN32
     #include <conio.h>
+    #include <io.h>
+    #include <windows.h>
 #else
+    #include <time.h>
+    #include <errno.h>
     #include <termios.h>
     #include <unistd.h>
+    #include <sys/uio.h>
 #endif
 
 #include "trap.h"
 #include "logger.h"
+#include "snapshot.h"
+#include "channel.h"
+#include "metrics.h"
+#include "fpu.h"
+#include "decode.h"
+#include "watch.h"
+
+static void trap_dispatch(vm_t *vm, size_t trap_number, uint8_t reg);
+
+/* Call a trap, reg is the value register of the TRAP instruction */
+void trap_call(vm_t *vm, size_t trap_number, uint8_t reg) {
+    vm->counters[VM_COUNTER_TRAPS]++;
+
+    if (vm->metrics == NULL) {
+        trap_dispatch(vm, trap_number, reg);
+        return;
+    }
+
+    uint64_t start = trap_clock_ns();
+    trap_dispatch(vm, trap_number, reg);
+    metrics_trap(vm, trap_number, trap_clock_ns() - start);
+}
+
+static void trap_dispatch(vm_t *vm, size_t trap_number, uint8_t reg) {
+    switch (trap_number)
+    {
+        case TRAP_PUTC: {
+            trap_putc(vm, reg);
+            break;
+        }
+
+        case TRAP_GETC: {
+            trap_getc(vm, reg);
+            break;
+        }
+
+        case TRAP_SNAPSHOT: {
+            trap_snapshot(vm, reg);
+            break;
+        }
+
+        case TRAP_SEND: {
+            trap_send(vm, reg);
+            break;
+        }
+
+        case TRAP_RECV: {
+            trap_recv(vm, reg);
+            break;
+        }
+
+        case TRAP_CLOSE: {
+            trap_close(vm, reg);
+            break;
+        }
+
+        case TRAP_READ: {
+            trap_read(vm, reg);
+            break;
+        }
+
+        case TRAP_WRITE: {
+            trap_write(vm, reg);
+            break;
+        }
+
+        case TRAP_WRITEV: {
+            trap_writev(vm, reg);
+            break;
+        }
+
+        case TRAP_MMAP: {
+            trap_mmap(vm, reg);
+            break;
+        }
+
+        case TRAP_MUNMAP: {
+            trap_munmap(vm, reg);
+            break;
+        }
+
+        case TRAP_CLOCK: {
+            trap_clock(vm, reg);
+            break;
+        }
+
+        case TRAP_COUNTER: {
+            trap_counter(vm, reg);
+            break;
+        }
+
+        case TRAP_PUTF: {
+            trap_putf(vm, reg);
+            break;
+        }
+
+        default: {
+            logger_error("Unknown trap number %zu at position %zu\n", trap_number, vm->pc);
+            break;
+        }
+    }
+}
 
 void trap_putc(vm_t *vm, uint8_t reg){
     int ch = vm->registers[reg];
 
-    putc(ch, stdout);
+    putc(ch, vm->output);
 }
 
 void trap_getc(vm_t *vm, uint8_t reg) {
     int ch;
     
-    #ifdef _WIN32
-        ch = _getch();
-    #else
-        struct termios oldt, newt;
-        tcgetattr(STDIN_FILENO, &oldt);
-        newt = oldt;
-        newt.c_lflag &= ~(ICANON | ECHO);
-        tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-    
-        ch = getchar();
+    if (vm->input == NULL) {
+        ch = EOF;
+    } else if (vm->input != stdin) {
+        ch = getc(vm->input);
+    } else {
+        #ifdef _WIN32
+            ch = _getch();
+        #else
+            /* Raw mode only for a terminal, pipes are read as they are */
+            struct termios oldt, newt;
+            bool tty = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &oldt) == 0;
+            if (tty) {
+                newt = oldt;
+                newt.c_lflag &= ~(ICANON | ECHO);
+                tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+            }
+        
+            ch = getchar();
 
-        tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    #endif
+            if (tty) {
+                tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+            }
+        #endif
+    }
     
     vm->registers[reg] = (size_t)ch;
     logger_print("TRAP_GETC: R%d = '%c' (0x%x)\n", reg, ch, ch);
     
     return;
 }
+
+void trap_snapshot(vm_t *vm, uint8_t reg) {
+    if (vm->snapshot_path == NULL) {
+        logger_error("TRAP_SNAPSHOT: No snapshot file given\n");
+        vm->registers[reg] = (size_t)-1;
+        return;
+    }
+
+    /* Restored VM sees 1, like the child side of fork() */
+    vm->registers[reg] = 1;
+    bool ok = snapshot_save(vm, vm->snapshot_path);
+    vm->registers[reg] = ok ? 0 : (size_t)-1;
+
+    return;
+}
+
+/* Check a guest buffer lies in memory, stops the VM if not */
+bool trap_buffer(vm_t *vm, size_t addr, size_t size) {
+    if (addr > vm->memory_size || size > vm->memory_size - addr) {
+        logger_error("Buffer 0x%zx+%zu out of memory at position %zu\n", addr, size, vm->pc);
+        vm->running = false;
+        return false;
+    }
+
+    return true;
+}
+
+static channel_t *trap_channel(vm_t *vm, size_t port) {
+    return (port < VM_CHANNELS) ? vm->channels[port] : NULL;
+}
+
+/* R(reg) port, R(reg+1) address, R(reg+2) size. R(reg) is the size sent, or -1 */
+void trap_send(vm_t *vm, uint8_t reg) {
+    channel_t *channel = trap_channel(vm, TRAP_ARG(vm, reg, 0));
+    size_t addr = TRAP_ARG(vm, reg, 1);
+    size_t size = TRAP_ARG(vm, reg, 2);
+
+    if (!trap_buffer(vm, addr, size)) {
+        return;
+    }
+
+    bool ok = channel && channel_send(channel, vm->memory + addr, size);
+    TRAP_ARG(vm, reg, 0) = ok ? size : (size_t)-1;
+
+    logger_print("TRAP_SEND: R%d = %zu\n", reg, TRAP_ARG(vm, reg, 0));
+
+    return;
+}
+
+/* R(reg) port, R(reg+1) address, R(reg+2) capacity. R(reg) is the size received, or -1 at the end */
+void trap_recv(vm_t *vm, uint8_t reg) {
+    channel_t *channel = trap_channel(vm, TRAP_ARG(vm, reg, 0));
+    size_t addr = TRAP_ARG(vm, reg, 1);
+    size_t capacity = TRAP_ARG(vm, reg, 2);
+    size_t size = 0;
+
+    if (!trap_buffer(vm, addr, capacity) || (vm->num_regions && !vm_writable(vm, addr, capacity))) {
+        return;
+    }
+
+    vm_watch_write(vm, addr, capacity);
+
+    bool ok = channel && channel_recv(channel, vm->memory + addr, capacity, &size);
+    TRAP_ARG(vm, reg, 0) = ok ? size : (size_t)-1;
+
+    if (ok) {
+        decode_written(vm, addr, size);
+    }
+
+    logger_print("TRAP_RECV: R%d = %zu\n", reg, TRAP_ARG(vm, reg, 0));
+
+    return;
+}
+
+/* R(reg) port */
+void trap_close(vm_t *vm, uint8_t reg) {
+    channel_t *channel = trap_channel(vm, vm->registers[reg]);
+
+    if (channel) {
+        channel_close(channel);
+    }
+
+    return;
+}
+
+/* Standard stream of a guest file number, NULL for host files */
+static FILE *trap_stream(vm_t *vm, size_t file) {
+    switch (file) {
+        case 0: return vm->input;
+        case 1: return vm->output;
+        case 2: return stderr;
+        default: return NULL;
+    }
+}
+
+static int trap_fd(vm_t *vm, size_t file) {
+    return (file >= 3 && file < VM_FILES) ? vm->files[file] : -1;
+}
+
+/* Write straight from guest memory, -1 on error */
+static long long trap_write_fd(int fd, const uint8_t *data, size_t size) {
+    size_t done = 0;
+
+    while (done < size) {
+        #if defined(_WIN32)
+            int n = _write(fd, data + done, (unsigned int)(size - done));
+        #else
+            ssize_t n = write(fd, data + done, size - done);
+            if (n < 0 && errno == EINTR) continue;
+        #endif
+        if (n <= 0) return -1;
+        done += n;
+    }
+
+    return (long long)done;
+}
+
+/* R(reg) file, R(reg+1) address, R(reg+2) size. R(reg) is the size read, 0 at the end, or -1.
+ * Data goes straight into guest memory, a host file may return less than asked */
+void trap_read(vm_t *vm, uint8_t reg) {
+    size_t file = TRAP_ARG(vm, reg, 0);
+    size_t addr = TRAP_ARG(vm, reg, 1);
+    size_t size = TRAP_ARG(vm, reg, 2);
+    long long result = -1;
+
+    if (!trap_buffer(vm, addr, size) || (vm->num_regions && !vm_writable(vm, addr, size))) {
+        return;
+    }
+
+    FILE *stream = trap_stream(vm, file);
+    int fd = trap_fd(vm, file);
+
+    /* read() fails on a watched page instead of faulting */
+    vm_watch_write(vm, addr, size);
+
+    if (file == 0) {
+        /* Shared with TRAP_GETC, so it goes through the same buffer */
+        if (stream == NULL) {
+            result = 0;
+        } else {
+            size_t n = fread(vm->memory + addr, 1, size, stream);
+            result = (n == 0 && ferror(stream)) ? -1 : (long long)n;
+        }
+    } else if (fd >= 0) {
+        #if defined(_WIN32)
+            result = _read(fd, vm->memory + addr, (unsigned int)size);
+        #else
+            ssize_t n;
+            do {
+                n = read(fd, vm->memory + addr, size);
+            } while (n < 0 && errno == EINTR);
+            result = n;
+        #endif
+    }
+
+    if (result > 0) {
+        decode_written(vm, addr, (size_t)result);
+    }
+
+    TRAP_ARG(vm, reg, 0) = (size_t)result;
+    logger_print("TRAP_READ: R%d = %lld\n", reg, result);
+
+    return;
+}
+
+/* R(reg) file, R(reg+1) address, R(reg+2) size. R(reg) is the size written, or -1 */
+void trap_write(vm_t *vm, uint8_t reg) {
+    size_t file = TRAP_ARG(vm, reg, 0);
+    size_t addr = TRAP_ARG(vm, reg, 1);
+    size_t size = TRAP_ARG(vm, reg, 2);
+    long long result = -1;
+
+    if (!trap_buffer(vm, addr, size)) {
+        return;
+    }
+
+    FILE *stream = trap_stream(vm, file);
+    int fd = trap_fd(vm, file);
+
+    if (stream) {
+        result = (fwrite(vm->memory + addr, 1, size, stream) == size) ? (long long)size : -1;
+    } else if (fd >= 0) {
+        result = trap_write_fd(fd, vm->memory + addr, size);
+    }
+
+    TRAP_ARG(vm, reg, 0) = (size_t)result;
+    logger_print("TRAP_WRITE: R%d = %lld\n", reg, result);
+
+    return;
+}
+
+#define TRAP_IOV_BATCH  64      // Buffers passed to one writev call
+
+/* Buffer of guest memory */
+struct trap_iov {
+    const uint8_t *data;
+    size_t size;
+};
+
+/* Write buffers with one system call, finishing a short write buffer by buffer */
+static bool trap_writev_fd(int fd, const struct trap_iov *bufs, size_t count) {
+    #if defined(_WIN32)
+        for (size_t k = 0; k < count; k++) {
+            if (trap_write_fd(fd, bufs[k].data, bufs[k].size) < 0) return false;
+        }
+        return true;
+    #else
+        struct iovec iov[TRAP_IOV_BATCH];
+        for (size_t k = 0; k < count; k++) {
+            iov[k].iov_base = (void *)bufs[k].data;
+            iov[k].iov_len = bufs[k].size;
+        }
+
+        ssize_t n;
+        do {
+            n = writev(fd, iov, (int)count);
+        } while (n < 0 && errno == EINTR);
+
+        for (size_t k = 0; n >= 0 && k < count; k++) {
+            if ((size_t)n >= bufs[k].size) {
+                n -= bufs[k].size;
+                continue;
+            }
+            if (trap_write_fd(fd, bufs[k].data + n, bufs[k].size - n) < 0) {
+                return false;
+            }
+            n = 0;
+        }
+
+        return n >= 0;
+    #endif
+}
+
+/* R(reg) file, R(reg+1) address of a list of (address, size) pairs of 8 bytes words,
+ * R(reg+2) number of pairs. R(reg) is the size written, or -1 */
+void trap_writev(vm_t *vm, uint8_t reg) {
+    size_t file = TRAP_ARG(vm, reg, 0);
+    size_t list = TRAP_ARG(vm, reg, 1);
+    size_t count = TRAP_ARG(vm, reg, 2);
+
+    if (count > vm->memory_size / 16) {
+        logger_error("Buffer list of %zu entries out of memory at position %zu\n", count, vm->pc);
+        vm->running = false;
+        return;
+    }
+    if (!trap_buffer(vm, list, count * 16)) {
+        return;
+    }
+
+    FILE *stream = trap_stream(vm, file);
+    int fd = trap_fd(vm, file);
+
+    /* Standard streams are flushed and written through their fd, memory streams have none */
+    if (stream) {
+        fflush(stream);
+        #if defined(_WIN32)
+            fd = -1;
+        #else
+            fd = fileno(stream);
+        #endif
+    }
+
+    long long result = (stream || fd >= 0) ? 0 : -1;
+
+    for (size_t i = 0; i < count && result >= 0; i += TRAP_IOV_BATCH) {
+        size_t batch = (count - i < TRAP_IOV_BATCH) ? count - i : TRAP_IOV_BATCH;
+        struct trap_iov bufs[TRAP_IOV_BATCH];
+        size_t total = 0;
+
+        for (size_t k = 0; k < batch; k++) {
+            uint64_t entry[2];
+            memcpy(entry, vm->memory + list + (i + k) * 16, sizeof(entry));
+
+            if (!trap_buffer(vm, (size_t)entry[0], (size_t)entry[1])) {
+                return;
+            }
+
+            bufs[k].data = vm->memory + entry[0];
+            bufs[k].size = (size_t)entry[1];
+            total += bufs[k].size;
+        }
+
+        bool ok = true;
+        if (fd >= 0) {
+            ok = trap_writev_fd(fd, bufs, batch);
+        } else {
+            for (size_t k = 0; k < batch && ok; k++) {
+                ok = fwrite(bufs[k].data, 1, bufs[k].size, stream) == bufs[k].size;
+            }
+        }
+
+        result = ok ? result + (long long)total : -1;
+    }
+
+    TRAP_ARG(vm, reg, 0) = (size_t)result;
+    logger_print("TRAP_WRITEV: R%d = %lld\n", reg, result);
+
+    return;
+}
+
+/* R(reg) file, R(reg+1) page aligned address, R(reg+2) size, R(reg+3) page aligned file offset,
+ * R(reg+4) 1 for a private writable copy, 0 for read-only. R(reg) is the size mapped, or -1 */
+void trap_mmap(vm_t *vm, uint8_t reg) {
+    int fd = trap_fd(vm, TRAP_ARG(vm, reg, 0));
+    size_t addr = TRAP_ARG(vm, reg, 1);
+    size_t size = TRAP_ARG(vm, reg, 2);
+    uint64_t offset = TRAP_ARG(vm, reg, 3);
+    bool writable = TRAP_ARG(vm, reg, 4) != 0;
+
+    size_t mapped = vm_map_file(vm, addr, size, fd, offset, writable);
+    TRAP_ARG(vm, reg, 0) = mapped ? mapped : (size_t)-1;
+
+    logger_print("TRAP_MMAP: R%d = %zu\n", reg, TRAP_ARG(vm, reg, 0));
+
+    return;
+}
+
+/* R(reg) address of a mapping. R(reg) is 0, or -1 if nothing is mapped there */
+void trap_munmap(vm_t *vm, uint8_t reg) {
+    bool ok = vm_unmap_file(vm, vm->registers[reg]);
+    vm->registers[reg] = ok ? 0 : (size_t)-1;
+
+    return;
+}
+
+/* Monotonic host clock in nanoseconds */
+uint64_t trap_clock_ns(void) {
+    #if defined(_WIN32)
+        static LARGE_INTEGER frequency;
+        LARGE_INTEGER now;
+
+        if (frequency.QuadPart == 0) {
+            QueryPerformanceFrequency(&frequency);
+        }
+        QueryPerformanceCounter(&now);
+
+        return (uint64_t)(now.QuadPart / frequency.QuadPart) * 1000000000ULL +
+               (uint64_t)(now.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    #endif
+}
+
+/* R(reg) is the monotonic clock in nanoseconds */
+void trap_clock(vm_t *vm, uint8_t reg) {
+    vm->registers[reg] = (size_t)trap_clock_ns();
+
+    return;
+}
+
+/* R(reg) counter number in vm_counter order, R(reg) is its value, or -1 if unknown */
+void trap_counter(vm_t *vm, uint8_t reg) {
+    size_t counter = vm->registers[reg];
+
+    vm->registers[reg] = (counter < VM_COUNTER_COUNT) ? (size_t)vm->counters[counter] : (size_t)-1;
+    logger_print("TRAP_COUNTER: R%d = %zu\n", reg, vm->registers[reg]);
+
+    return;
+}
+
+/* R(reg) is printed as a binary64 float, with the fewest digits reading back the same value */
+void trap_putf(vm_t *vm, uint8_t reg) {
+    double value = fpu_double(vm->registers[reg]);
+    char text[32];
+
+    for (int digits = 15; digits <= 17; digits++) {
+        snprintf(text, sizeof(text), "%.*g", digits, value);
+        if (isnan(value) || strtod(text, NULL) == value) {
+            break;
+        }
+    }
+
+    fputs(text, vm->output);
+
+    return;
+}
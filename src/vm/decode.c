@@ -0,0 +1,447 @@
+/* 
+ *
+ *      decode.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#if !defined(_WIN32)
+    #include <sys/mman.h>
+#endif
+
+#include "instruction.h"
+#include "logger.h"
+#include "vm.h"
+#include "trap.h"
+#include "decode.h"
+#include "thread.h"
+#include "perf.h"
+#include "sample.h"
+#include "metrics.h"
+#include "vmem.h"
+#include "fpu.h"
+#include "guard.h"
+
+/* Decode and verify the instruction starting at pc */
+static void decode_one(decoded_insn_t *insn, const uint8_t *code, size_t code_size, size_t pc, uint8_t mask) {
+    memset(insn, 0, sizeof(*insn));
+
+    uint8_t opcode = code[pc];
+    size_t length = instruction_length(opcode);
+
+    insn->opcode = opcode;
+
+    /* Unknown or incomplete instructions are left with length 0 */
+    if (length == 0 || pc + length > code_size) {
+        return;
+    }
+
+    size_t pos = pc + 1;
+    int reg = 0;
+    for (const char *p = instruction_table[opcode].operands; *p; p++) {
+        if (*p == 'i') {
+            uint64_t value = 0;
+            for (int i = 0; i < 8; i++) {
+                value |= (uint64_t)code[pos++] << (i * 8);
+            }
+            insn->imm = value;
+        } else {
+            insn->regs[reg++] = code[pos++] & mask;
+        }
+    }
+
+    insn->length = (uint8_t)length;
+}
+
+/* Decode every byte offset of the code, so any jump target is covered */
+bool decode_program(decoded_program_t *prog, const uint8_t *code, size_t code_size, uint32_t version) {
+    memset(prog, 0, sizeof(*prog));
+
+    prog->insns = (decoded_insn_t *)calloc(code_size ? code_size : 1, sizeof(decoded_insn_t));
+    if (prog->insns == NULL) {
+        logger_error("Failed to allocate decoded program\n");
+        return false;
+    }
+
+    uint8_t mask = vm_register_mask(version);
+    for (size_t pc = 0; pc < code_size; pc++) {
+        decode_one(&prog->insns[pc], code, code_size, pc, mask);
+    }
+
+    prog->code_size = code_size;
+    prog->version = version;
+
+    return true;
+}
+
+/* Decode again every instruction overlapping a modified range of code. Only an
+ * instruction that really changed is replaced, and the branch links are only dropped
+ * when it is one decode_link reached, so data kept next to the code costs nothing */
+void decode_refresh(decoded_program_t *prog, const uint8_t *code, size_t addr, size_t size) {
+    size_t max_length = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        size_t length = instruction_length((uint8_t)op);
+        if (length > max_length) max_length = length;
+    }
+
+    uint8_t mask = vm_register_mask(prog->version);
+    size_t start = (addr >= max_length) ? addr - max_length + 1 : 0;
+    size_t end = (addr + size < prog->code_size) ? addr + size : prog->code_size;
+
+    for (size_t pc = start; pc < end; pc++) {
+        decoded_insn_t *old = &prog->insns[pc];
+        decoded_insn_t insn;
+        decode_one(&insn, code, prog->code_size, pc, mask);
+
+        /* A linked branch keeps its target in imm, branches have no immediate of their own */
+        if (insn.opcode == old->opcode && insn.length == old->length &&
+            memcmp(insn.regs, old->regs, sizeof(insn.regs)) == 0 &&
+            (insn.imm == old->imm || (old->flags & DECODE_STATIC))) {
+            continue;
+        }
+
+        if (prog->linked && (old->flags & DECODE_REACHED)) {
+            decode_unlink(prog);
+        }
+
+        insn.flags = old->flags & ~DECODE_STATIC;
+        *old = insn;
+    }
+}
+
+void decode_free(decoded_program_t *prog) {
+    if (prog->mapping) {
+        #if defined(_WIN32)
+            free(prog->mapping);
+        #else
+            munmap(prog->mapping, prog->mapping_size);
+        #endif
+    } else {
+        free(prog->insns);
+    }
+
+    memset(prog, 0, sizeof(*prog));
+}
+
+static void decoded_frame(vm_t *vm, void *arg);
+
+/* A jump decode_link could not follow must land where it assumed no register known,
+ * or a return site for a RET */
+static inline void decoded_land(decoded_program_t *prog, size_t pc, uint8_t allowed) {
+    if (prog->linked && pc < prog->code_size && !(prog->insns[pc].flags & allowed)) {
+        decode_unlink(prog);
+    }
+}
+
+/* Target of a taken branch, linked to the constant found by decode_link when there is one */
+static inline size_t decoded_target(decoded_program_t *prog, const decoded_insn_t *in, const size_t *r, int reg) {
+    if (in->flags & DECODE_STATIC) {
+        return (size_t)in->imm;
+    }
+
+    size_t target = r[in->regs[reg]];
+    decoded_land(prog, target, DECODE_ENTRY);
+    return target;
+}
+
+/* Sized load of R(0) from R(1) + imm, size is a constant so each case is a single host load */
+static inline void decoded_load(vm_t *vm, const decoded_insn_t *in, size_t size, bool sign) {
+    size_t addr = (vm->registers[in->regs[1]] + (size_t)in->imm) & vm->memory_mask;
+    uint64_t value = vmem_load(vm->memory + addr, size);
+    vm->counters[VM_COUNTER_MEMORY]++;
+    vm->registers[in->regs[0]] = sign ? vmem_extend(value, size) : value;
+}
+
+/* Sized store of R(0) to R(1) + imm */
+static inline void decoded_store(vm_t *vm, decoded_program_t *prog, const decoded_insn_t *in, size_t size) {
+    size_t addr = (vm->registers[in->regs[1]] + (size_t)in->imm) & vm->memory_mask;
+
+    if (vm->num_regions && !vm_writable(vm, addr, size)) {
+        return;
+    }
+
+    vm->counters[VM_COUNTER_MEMORY]++;
+    vmem_store(vm->memory + addr, size, vm->registers[in->regs[0]]);
+
+    /* Self modifying code */
+    if (addr < prog->code_size) {
+        decode_refresh(prog, vm->memory, addr, size);
+    }
+}
+
+/* Run until the VM stops or a RET pops the stack above frame */
+static void decoded_loop(vm_t *vm, decoded_program_t *prog, size_t frame) {
+    size_t *r = vm->registers;
+
+    while (vm->running && vm->pc < prog->code_size) {
+        const decoded_insn_t *in = &prog->insns[vm->pc];
+
+        if (vm->counters[VM_COUNTER_INSTRUCTIONS] == vm->event_at && !vm_event(vm)) {
+            break;
+        }
+
+        vm->counters[VM_COUNTER_INSTRUCTIONS]++;
+        vm->insn_pc = vm->pc;
+
+        if (in->length == 0) {
+            if (instruction_length(in->opcode) == 0) {
+                logger_error("Unknown opcode: 0x%02X at position %zu\n", in->opcode, vm->pc);
+            } else {
+                logger_error("Incomplete %s instruction\n", instruction_table[in->opcode].mnemonic);
+            }
+
+            vm->running = false;
+            break;
+        }
+
+        vm->pc += in->length;
+
+        switch (in->opcode) {
+            case OP_HALT: {
+                vm->running = false;
+                vm->halted = true;
+
+                logger_print("HLT: Program terminated\n");
+                break;
+            }
+
+            case OP_LOAD: r[in->regs[0]] = (size_t)in->imm; break;
+
+            case OP_LA: {
+                uint64_t value = vmem_load(vm->memory + ((size_t)in->imm & vm->memory_mask), 8);
+                vm->counters[VM_COUNTER_MEMORY]++;
+                r[in->regs[0]] = value;
+                break;
+            }
+
+            case OP_SA: {
+                size_t addr = (size_t)in->imm & vm->memory_mask;
+                if (vm->num_regions && !vm_writable(vm, addr, 8)) {
+                    break;
+                }
+                vm->counters[VM_COUNTER_MEMORY]++;
+                vmem_store(vm->memory + addr, 8, r[in->regs[0]]);
+
+                /* Self modifying code */
+                if (addr < prog->code_size) {
+                    decode_refresh(prog, vm->memory, addr, 8);
+                }
+                break;
+            }
+
+            case OP_MOV: r[in->regs[0]] = r[in->regs[1]]; break;
+
+            case OP_ADD: r[in->regs[0]] = r[in->regs[1]] + r[in->regs[2]]; break;
+            case OP_SUB: r[in->regs[0]] = r[in->regs[1]] - r[in->regs[2]]; break;
+            case OP_MULTI: r[in->regs[0]] = r[in->regs[1]] * r[in->regs[2]]; break;
+
+            case OP_DIVIDE: {
+                if (r[in->regs[2]] == 0) {
+                    logger_error("Division by zero at position %zu\n", vm->pc - in->length);
+                    vm->running = false;
+                    break;
+                }
+                r[in->regs[0]] = r[in->regs[1]] / r[in->regs[2]];
+                break;
+            }
+
+            case OP_INCREASE: r[in->regs[0]]++; break;
+            case OP_DECREASE: r[in->regs[0]]--; break;
+
+            case OP_AND: r[in->regs[0]] = r[in->regs[1]] & r[in->regs[2]]; break;
+            case OP_NOT: r[in->regs[0]] = !r[in->regs[0]]; break;
+            case OP_OR: r[in->regs[0]] = r[in->regs[1]] | r[in->regs[2]]; break;
+            case OP_XOR: r[in->regs[0]] = r[in->regs[1]] ^ r[in->regs[2]]; break;
+            case OP_CMP: r[in->regs[0]] = (r[in->regs[1]] == r[in->regs[2]]); break;
+
+            case OP_JUMP: {
+                vm_branch(vm, decoded_target(prog, in, r, 0));
+                break;
+            }
+
+            case OP_JNZ: {
+                if (r[in->regs[0]]) {
+                    vm_branch(vm, decoded_target(prog, in, r, 1));
+                }
+                break;
+            }
+
+            case OP_JZ: {
+                if (!r[in->regs[0]]) {
+                    vm_branch(vm, decoded_target(prog, in, r, 1));
+                }
+                break;
+            }
+
+            case OP_LOOP: {
+                if (r[in->regs[0]]) {
+                    r[in->regs[0]]--;
+                    vm_branch(vm, decoded_target(prog, in, r, 1));
+                }
+                break;
+            }
+
+            case OP_TRAP: trap_call(vm, r[in->regs[0]], in->regs[1]); break;
+
+            case OP_PRINT: {
+                logger_print("PRT: R%d = %zu\n", in->regs[0], r[in->regs[0]]);
+                break;
+            }
+
+            case OP_PUSH: vm_push(vm, r[in->regs[0]]); break;
+            case OP_POP: vm_pop(vm, &r[in->regs[0]]); break;
+            case OP_CALL: {
+                vm_call(vm, decoded_target(prog, in, r, 0));
+                if (vm->perf && vm->running) {
+                    perf_call(vm, decoded_frame, prog);
+                }
+                break;
+            }
+
+            case OP_RET: {
+                vm_return(vm);
+                decoded_land(prog, vm->pc, DECODE_ENTRY | DECODE_RETURN);
+                if (vm->sp > frame) {
+                    return;
+                }
+                break;
+            }
+
+            case OP_SPAWN: {
+                decoded_land(prog, r[in->regs[1]], DECODE_ENTRY);
+                vm_spawn(vm, r[in->regs[1]], r[in->regs[2]], in->regs[0]);
+                break;
+            }
+            case OP_JOIN: vm_join(vm, r[in->regs[1]], &r[in->regs[0]]); break;
+
+            case OP_CAS:
+            case OP_FADD:
+            case OP_XCHG: vm_atomic(vm, in->opcode, r[in->regs[1]], r[in->regs[2]], &r[in->regs[0]]); break;
+
+            case OP_FENCE: vm_fence(); break;
+
+            case OP_LDB: decoded_load(vm, in, 1, false); break;
+            case OP_LDBS: decoded_load(vm, in, 1, true); break;
+            case OP_LDH: decoded_load(vm, in, 2, false); break;
+            case OP_LDHS: decoded_load(vm, in, 2, true); break;
+            case OP_LDW: decoded_load(vm, in, 4, false); break;
+            case OP_LDWS: decoded_load(vm, in, 4, true); break;
+            case OP_LDQ: decoded_load(vm, in, 8, false); break;
+            case OP_STB: decoded_store(vm, prog, in, 1); break;
+            case OP_STH: decoded_store(vm, prog, in, 2); break;
+            case OP_STW: decoded_store(vm, prog, in, 4); break;
+            case OP_STQ: decoded_store(vm, prog, in, 8); break;
+
+            case OP_SLT: r[in->regs[0]] = ((int64_t)r[in->regs[1]] < (int64_t)r[in->regs[2]]); break;
+            case OP_SLTU: r[in->regs[0]] = (r[in->regs[1]] < r[in->regs[2]]); break;
+            case OP_SLE: r[in->regs[0]] = ((int64_t)r[in->regs[1]] <= (int64_t)r[in->regs[2]]); break;
+            case OP_SLEU: r[in->regs[0]] = (r[in->regs[1]] <= r[in->regs[2]]); break;
+            case OP_SEL: r[in->regs[0]] = r[in->regs[1]] ? r[in->regs[2]] : r[in->regs[0]]; break;
+
+            case OP_BEQ: {
+                if (r[in->regs[0]] == r[in->regs[1]]) {
+                    vm_branch(vm, decoded_target(prog, in, r, 2));
+                }
+                break;
+            }
+
+            case OP_BNE: {
+                if (r[in->regs[0]] != r[in->regs[1]]) {
+                    vm_branch(vm, decoded_target(prog, in, r, 2));
+                }
+                break;
+            }
+
+            case OP_BLT: {
+                if ((int64_t)r[in->regs[0]] < (int64_t)r[in->regs[1]]) {
+                    vm_branch(vm, decoded_target(prog, in, r, 2));
+                }
+                break;
+            }
+
+            case OP_BLTU: {
+                if (r[in->regs[0]] < r[in->regs[1]]) {
+                    vm_branch(vm, decoded_target(prog, in, r, 2));
+                }
+                break;
+            }
+
+            case OP_FADDD: r[in->regs[0]] = fpu_bits(fpu_double(r[in->regs[1]]) + fpu_double(r[in->regs[2]])); break;
+            case OP_FSUBD: r[in->regs[0]] = fpu_bits(fpu_double(r[in->regs[1]]) - fpu_double(r[in->regs[2]])); break;
+            case OP_FMULD: r[in->regs[0]] = fpu_bits(fpu_double(r[in->regs[1]]) * fpu_double(r[in->regs[2]])); break;
+            case OP_FDIVD: r[in->regs[0]] = fpu_bits(fpu_double(r[in->regs[1]]) / fpu_double(r[in->regs[2]])); break;
+            case OP_FMAD: {
+                double acc = fpu_double(r[in->regs[0]]);
+                r[in->regs[0]] = fpu_bits(fma(fpu_double(r[in->regs[1]]), fpu_double(r[in->regs[2]]), acc));
+                break;
+            }
+            case OP_FSQRTD: r[in->regs[0]] = fpu_bits(sqrt(fpu_double(r[in->regs[1]]))); break;
+            case OP_FEQD: r[in->regs[0]] = (fpu_double(r[in->regs[1]]) == fpu_double(r[in->regs[2]])); break;
+            case OP_FLTD: r[in->regs[0]] = (fpu_double(r[in->regs[1]]) < fpu_double(r[in->regs[2]])); break;
+            case OP_FLED: r[in->regs[0]] = (fpu_double(r[in->regs[1]]) <= fpu_double(r[in->regs[2]])); break;
+            case OP_ITOF: r[in->regs[0]] = fpu_bits((double)(int64_t)r[in->regs[1]]); break;
+            case OP_FTOI: r[in->regs[0]] = fpu_to_int(fpu_double(r[in->regs[1]])); break;
+
+            default: break;
+        }
+    }
+}
+
+/* Guest function entered through perf_call */
+static void decoded_frame(vm_t *vm, void *arg) {
+    decoded_loop(vm, (decoded_program_t *)arg, vm->sp);
+}
+
+/* Run VM on a decoded program, without per instruction tracing */
+void vm_run_decoded(vm_t *vm, decoded_program_t *prog) {
+    logger_print("Starting VM execution...\n");
+    vm_enter_decoded(vm, prog);
+}
+
+/* Continue a VM on a decoded program from its current state */
+void vm_enter_decoded(vm_t *vm, decoded_program_t *prog) {
+    vm->program = prog;
+
+    /* Threads start from a program already analysed by the main thread */
+    if (!prog->analysed && vm->thread_id == 0) {
+        decode_link(prog, vm->pc, vm->registers);
+    }
+
+    vm_schedule(vm);
+    sample_attach(vm);
+    metrics_attach(vm);
+
+    vm_guard_t guard;
+    vm_guard_enter(vm, &guard);
+    if (!VM_GUARD_TRY(&guard)) {
+        vm_guard_fault(&guard);     // Guest memory fault, the run is over
+    } else if (vm->perf) {
+        perf_call(vm, decoded_frame, prog);
+    } else {
+        decoded_loop(vm, prog, SIZE_MAX);
+    }
+    vm_guard_leave(&guard);
+
+    metrics_detach(vm);
+    sample_attach(NULL);
+
+    if (vm->running) {
+        logger_print("VM execution completed\n");
+    }
+
+    if (vm->thread_id == 0) {
+        vm_join_all(vm);
+    }
+}
@@ -0,0 +1,108 @@
+/* 
+ *
+ *      guard.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+    #include <signal.h>
+    #include <pthread.h>
+#endif
+
+#include "logger.h"
+#include "vm.h"
+#include "vmem.h"
+#include "guard.h"
+#include "watch.h"
+
+/* Innermost run on this thread, read by the signal handler */
+static _Thread_local vm_guard_t *volatile guard_current;
+
+#if !defined(_WIN32)
+
+static pthread_once_t guard_once = PTHREAD_ONCE_INIT;
+
+/* Faults inside the reservation of the running VM are guest faults, any other is a host bug */
+static void guard_handler(int sig, siginfo_t *info, void *context) {
+    (void)context;
+
+    vm_guard_t *guard = guard_current;
+    if (guard) {
+        const uint8_t *addr = (const uint8_t *)info->si_addr;
+        const uint8_t *memory = guard->vm->memory;
+
+        /* A write to a watched page, retried once the page is open */
+        if (addr >= memory && (size_t)(addr - memory) < vmem_round(guard->vm->memory_size) &&
+            vm_watch_fault(guard->vm, (size_t)(addr - memory))) {
+            return;
+        }
+
+        if (addr >= memory && (size_t)(addr - memory) < vmem_reserved(guard->vm->memory_size)) {
+            guard->fault = (size_t)(addr - memory);
+            siglongjmp(guard->env, 1);
+        }
+    }
+
+    /* Fault again on return, without the handler */
+    signal(sig, SIG_DFL);
+}
+
+/* Deferred so the handler can fault again after a jump without restoring the mask */
+static void guard_install(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = guard_handler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGSEGV, &action, NULL) != 0 || sigaction(SIGBUS, &action, NULL) != 0) {
+        logger_error("Failed to install the guest memory fault handler\n");
+    }
+}
+
+#endif
+
+/* Make guard the recovery point of faults in the memory of vm on this thread */
+void vm_guard_enter(vm_t *vm, vm_guard_t *guard) {
+    #if !defined(_WIN32)
+        pthread_once(&guard_once, guard_install);
+        vmem_page_size();   // Cached before the handler needs it
+    #endif
+
+    guard->vm = vm;
+    guard->fault = 0;
+    guard->prev = guard_current;
+    guard_current = guard;
+}
+
+/* Stop the VM after its run jumped back to guard */
+void vm_guard_fault(vm_guard_t *guard) {
+    vm_t *vm = guard->vm;
+
+    /* The jump skipped leaving any guard entered deeper in the run */
+    guard_current = guard;
+
+    logger_error("Invalid memory access to 0x%zx at position %zu\n", guard->fault, vm->pc);
+    vm->running = false;
+}
+
+/* Writes to watched pages by the last instructions are reported before the run returns */
+void vm_guard_leave(vm_guard_t *guard) {
+    if (guard->vm->watch_pending) {
+        vm_watch_check(guard->vm);
+    }
+
+    guard_current = guard->prev;
+}
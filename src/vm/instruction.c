@@ -0,0 +1,132 @@
+/* 
+ *
+ *      instruction.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "instruction.h"
+
+/* Instruction table, must be kept in sync with asm/asm.c */
+const instruction_info_t instruction_table[OP_COUNT] = {
+    [OP_HALT]       = {"HLT",   ""},
+    [OP_LOAD]       = {"LD",    "ri"},
+    [OP_LA]         = {"LA",    "ri"},
+    [OP_SA]         = {"SA",    "ri"},
+    [OP_MOV]        = {"MOV",   "rr"},
+
+    [OP_ADD]        = {"ADD",   "rrr"},
+    [OP_SUB]        = {"SUB",   "rrr"},
+    [OP_MULTI]      = {"MUL",   "rrr"},
+    [OP_DIVIDE]     = {"DIV",   "rrr"},
+
+    [OP_INCREASE]   = {"INC",   "r"},
+    [OP_DECREASE]   = {"DEC",   "r"},
+
+    [OP_AND]        = {"AND",   "rrr"},
+    [OP_NOT]        = {"NOT",   "r"},
+    [OP_OR]         = {"OR",    "rrr"},
+    [OP_XOR]        = {"XOR",   "rrr"},
+    [OP_CMP]        = {"CMP",   "rrr"},
+
+    [OP_JUMP]       = {"JMP",   "r"},
+    [OP_JNZ]        = {"JNZ",   "rr"},
+    [OP_JZ]         = {"JZ",    "rr"},
+    [OP_LOOP]       = {"LOOP",  "rr"},
+
+    [OP_TRAP]       = {"TRAP",  "rr"},
+
+    [OP_PRINT]      = {"PRT",   "r"},
+
+    [OP_PUSH]       = {"PUSH",  "r"},
+    [OP_POP]        = {"POP",   "r"},
+    [OP_CALL]       = {"CALL",  "r"},
+    [OP_RET]        = {"RET",   ""},
+
+    [OP_SPAWN]      = {"SPAWN", "rrr"},
+    [OP_JOIN]       = {"JOIN",  "rr"},
+    [OP_CAS]        = {"CAS",   "rrr"},
+    [OP_FADD]       = {"FADD",  "rrr"},
+    [OP_XCHG]       = {"XCHG",  "rrr"},
+    [OP_FENCE]      = {"FENCE", ""},
+
+    [OP_LDB]        = {"LDB",   "rri"},
+    [OP_LDBS]       = {"LDBS",  "rri"},
+    [OP_LDH]        = {"LDH",   "rri"},
+    [OP_LDHS]       = {"LDHS",  "rri"},
+    [OP_LDW]        = {"LDW",   "rri"},
+    [OP_LDWS]       = {"LDWS",  "rri"},
+    [OP_LDQ]        = {"LDQ",   "rri"},
+    [OP_STB]        = {"STB",   "rri"},
+    [OP_STH]        = {"STH",   "rri"},
+    [OP_STW]        = {"STW",   "rri"},
+    [OP_STQ]        = {"STQ",   "rri"},
+
+    [OP_SLT]        = {"SLT",   "rrr"},
+    [OP_SLTU]       = {"SLTU",  "rrr"},
+    [OP_SLE]        = {"SLE",   "rrr"},
+    [OP_SLEU]       = {"SLEU",  "rrr"},
+    [OP_SEL]        = {"SEL",   "rrr"},
+
+    [OP_BEQ]        = {"BEQ",   "rrr"},
+    [OP_BNE]        = {"BNE",   "rrr"},
+    [OP_BLT]        = {"BLT",   "rrr"},
+    [OP_BLTU]       = {"BLTU",  "rrr"},
+
+    [OP_FADDD]      = {"FADDD", "rrr"},
+    [OP_FSUBD]      = {"FSUBD", "rrr"},
+    [OP_FMULD]      = {"FMULD", "rrr"},
+    [OP_FDIVD]      = {"FDIVD", "rrr"},
+    [OP_FMAD]       = {"FMAD",  "rrr"},
+    [OP_FSQRTD]     = {"FSQRTD", "rr"},
+    [OP_FEQD]       = {"FEQD",  "rrr"},
+    [OP_FLTD]       = {"FLTD",  "rrr"},
+    [OP_FLED]       = {"FLED",  "rrr"},
+    [OP_ITOF]       = {"ITOF",  "rr"},
+    [OP_FTOI]       = {"FTOI",  "rr"},
+};
+
+/* Get encoded length of an instruction, 0 if the opcode is unknown */
+size_t instruction_length(uint8_t opcode) {
+    if (opcode >= OP_COUNT || instruction_table[opcode].mnemonic == NULL) {
+        return 0;
+    }
+
+    size_t length = 1;
+    for (const char *p = instruction_table[opcode].operands; *p; p++) {
+        length += (*p == 'i') ? 8 : 1;
+    }
+
+    return length;
+}
+
+/* FNV-1a hash of the instruction table, changes whenever the ISA does */
+uint64_t instruction_table_hash(void) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int op = 0; op < OP_COUNT; op++) {
+        const char *fields[2] = {
+            instruction_table[op].mnemonic ? instruction_table[op].mnemonic : "",
+            instruction_table[op].operands ? instruction_table[op].operands : "",
+        };
+
+        for (int f = 0; f < 2; f++) {
+            for (const char *p = fields[f]; ; p++) {
+                hash ^= (uint8_t)*p;
+                hash *= 0x100000001b3ULL;
+                if (*p == '\0') break;
+            }
+        }
+    }
+
+    return hash;
+}
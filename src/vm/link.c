@@ -0,0 +1,395 @@
+/* 
+ *
+ *      link.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "instruction.h"
+#include "logger.h"
+#include "vm.h"
+#include "decode.h"
+
+/* Registers known to hold a constant on every path reaching an instruction */
+struct link_state {
+    uint64_t value[VM_REGISTERS];
+    uint32_t known;             // Bit n set if R(n) holds value[n]
+};
+
+typedef struct link_state link_state_t;
+
+/* Analysis of a decoded program, states[pc] is NULL while pc is unreached */
+struct link_pass {
+    decoded_program_t *prog;
+    link_state_t **states;
+    size_t *worklist;
+    size_t pending;
+    uint8_t *queued;
+    size_t *returns;            // Return sites found so far
+    size_t num_returns;
+    link_state_t returned;      // Registers at every RET reached so far
+    bool any_return;
+    bool failed;
+};
+
+/* Fold the state reaching pc into what is known there, queueing pc if it changed */
+static void link_merge(struct link_pass *pass, size_t pc, const link_state_t *in) {
+    if (pc >= pass->prog->code_size) {
+        return;
+    }
+
+    link_state_t *state = pass->states[pc];
+
+    if (state == NULL) {
+        state = (link_state_t *)malloc(sizeof(link_state_t));
+        if (state == NULL) {
+            pass->failed = true;
+            return;
+        }
+        *state = *in;
+        pass->states[pc] = state;
+    } else {
+        uint32_t known = state->known & in->known;
+        for (int i = 0; i < VM_REGISTERS; i++) {
+            if (state->value[i] != in->value[i]) {
+                known &= ~(1u << i);
+            }
+        }
+
+        if (known == state->known) {
+            return;
+        }
+        state->known = known;
+    }
+
+    if (!pass->queued[pc]) {
+        pass->queued[pc] = 1;
+        pass->worklist[pass->pending++] = pc;
+    }
+}
+
+/* Start of code reachable with nothing known, such as a return site. Any jump may land here */
+static void link_entry(struct link_pass *pass, size_t pc) {
+    link_state_t none;
+    memset(&none, 0, sizeof(none));
+
+    if (pc < pass->prog->code_size) {
+        pass->prog->insns[pc].flags |= DECODE_ENTRY;
+        link_merge(pass, pc, &none);
+    }
+}
+
+/* Instruction after a CALL, entered by a RET with the registers any RET may have */
+static void link_return_site(struct link_pass *pass, size_t pc) {
+    if (pc >= pass->prog->code_size || (pass->prog->insns[pc].flags & DECODE_RETURN)) {
+        return;
+    }
+
+    pass->prog->insns[pc].flags |= DECODE_RETURN;
+    pass->returns[pass->num_returns++] = pc;
+
+    if (pass->any_return) {
+        link_merge(pass, pc, &pass->returned);
+    }
+}
+
+/* Registers at a RET reach every return site, a RET landing elsewhere is checked when taken */
+static void link_return(struct link_pass *pass, const link_state_t *state) {
+    if (pass->any_return) {
+        uint32_t known = pass->returned.known & state->known;
+        for (int i = 0; i < VM_REGISTERS; i++) {
+            if (pass->returned.value[i] != state->value[i]) {
+                known &= ~(1u << i);
+            }
+        }
+
+        if (known == pass->returned.known) {
+            return;
+        }
+        pass->returned.known = known;
+    } else {
+        pass->returned = *state;
+        pass->any_return = true;
+    }
+
+    for (size_t i = 0; i < pass->num_returns; i++) {
+        link_merge(pass, pass->returns[i], &pass->returned);
+    }
+}
+
+static void link_set(link_state_t *state, uint8_t reg, uint64_t value) {
+    state->value[reg] = value;
+    state->known |= 1u << reg;
+}
+
+static void link_forget(link_state_t *state, uint8_t reg) {
+    state->value[reg] = 0;
+    state->known &= ~(1u << reg);
+}
+
+static bool link_known(const link_state_t *state, uint8_t reg) {
+    return (state->known >> reg) & 1;
+}
+
+/* Registers after the instruction, constants are folded for the common ALU operations */
+static void link_transfer(link_state_t *state, const decoded_insn_t *in) {
+    const uint8_t *regs = in->regs;
+    bool both = link_known(state, regs[1]) && link_known(state, regs[2]);
+    uint64_t a = state->value[regs[1]];
+    uint64_t b = state->value[regs[2]];
+
+    switch (in->opcode) {
+        case OP_LOAD: link_set(state, regs[0], in->imm); break;
+
+        case OP_MOV: {
+            if (link_known(state, regs[1])) {
+                link_set(state, regs[0], a);
+            } else {
+                link_forget(state, regs[0]);
+            }
+            break;
+        }
+
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MULTI:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+        case OP_CMP: {
+            if (!both) {
+                link_forget(state, regs[0]);
+                break;
+            }
+
+            uint64_t value = 0;
+            switch (in->opcode) {
+                case OP_ADD: value = a + b; break;
+                case OP_SUB: value = a - b; break;
+                case OP_MULTI: value = a * b; break;
+                case OP_AND: value = a & b; break;
+                case OP_OR: value = a | b; break;
+                case OP_XOR: value = a ^ b; break;
+                default: value = (a == b); break;
+            }
+            link_set(state, regs[0], value);
+            break;
+        }
+
+        case OP_INCREASE:
+        case OP_DECREASE:
+        case OP_NOT: {
+            if (!link_known(state, regs[0])) {
+                break;
+            }
+
+            uint64_t value = state->value[regs[0]];
+            value = (in->opcode == OP_INCREASE) ? value + 1 : (in->opcode == OP_DECREASE) ? value - 1 : !value;
+            link_set(state, regs[0], value);
+            break;
+        }
+
+        /* Traps may write any register */
+        case OP_TRAP: state->known = 0; break;
+
+        /* No register written */
+        case OP_HALT:
+        case OP_SA:
+        case OP_JUMP:
+        case OP_JNZ:
+        case OP_JZ:
+        case OP_PRINT:
+        case OP_PUSH:
+        case OP_CALL:
+        case OP_RET:
+        case OP_FENCE:
+        case OP_STB:
+        case OP_STH:
+        case OP_STW:
+        case OP_STQ:
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BLTU: break;
+
+        default: link_forget(state, regs[0]); break;
+    }
+}
+
+/* Register holding the target of a branch, -1 for other instructions */
+static int link_target_reg(const decoded_insn_t *in) {
+    switch (in->opcode) {
+        case OP_JUMP:
+        case OP_CALL: return 0;
+
+        case OP_JNZ:
+        case OP_JZ:
+        case OP_SPAWN: return 1;
+
+        /* The counter is decremented before the jump, so it can not be the target too */
+        case OP_LOOP: return (in->regs[0] != in->regs[1]) ? 1 : -1;
+
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BLTU: return 2;
+
+        default: return -1;
+    }
+}
+
+/* Follow the instruction at pc to its successors */
+static void link_visit(struct link_pass *pass, size_t pc) {
+    decoded_insn_t *in = &pass->prog->insns[pc];
+
+    /* Faults when reached */
+    if (in->length == 0) {
+        return;
+    }
+
+    link_state_t state = *pass->states[pc];
+    int target_reg = link_target_reg(in);
+    bool known = target_reg >= 0 && link_known(&state, in->regs[target_reg]);
+    uint64_t target = known ? state.value[in->regs[target_reg]] : 0;
+    size_t next = pc + in->length;
+
+    link_transfer(&state, in);
+
+    switch (in->opcode) {
+        case OP_HALT: break;
+        case OP_RET: link_return(pass, &state); break;
+
+        case OP_JUMP: {
+            if (known) link_merge(pass, (size_t)target, &state);
+            break;
+        }
+
+        case OP_CALL: {
+            if (known) link_merge(pass, (size_t)target, &state);
+            link_return_site(pass, next);
+            break;
+        }
+
+        case OP_SPAWN: {
+            if (known) link_entry(pass, (size_t)target);
+            link_merge(pass, next, &state);
+            break;
+        }
+
+        case OP_JNZ:
+        case OP_JZ:
+        case OP_LOOP:
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BLTU: {
+            if (known) link_merge(pass, (size_t)target, &state);
+            link_merge(pass, next, &state);
+            break;
+        }
+
+        default: link_merge(pass, next, &state); break;
+    }
+}
+
+/* Constant propagation over the control flow graph from entry, where the run starts
+ * with registers, and from pc 0 when it is not the start. Branches whose
+ * target register holds the same constant on every path get DECODE_STATIC, with the
+ * target in imm. Jumps the analysis could not follow are checked when taken, landing
+ * anywhere but a DECODE_ENTRY instruction, or a DECODE_RETURN one for a RET, drops
+ * the result, see decode_unlink */
+void decode_link(decoded_program_t *prog, size_t entry, const size_t *registers) {
+    prog->analysed = true;
+
+    if (prog->code_size == 0) {
+        return;
+    }
+
+    struct link_pass pass;
+    memset(&pass, 0, sizeof(pass));
+    pass.prog = prog;
+    pass.states = (link_state_t **)calloc(prog->code_size, sizeof(link_state_t *));
+    pass.worklist = (size_t *)malloc(prog->code_size * sizeof(size_t));
+    pass.queued = (uint8_t *)calloc(prog->code_size, 1);
+    pass.returns = (size_t *)malloc(prog->code_size * sizeof(size_t));
+
+    if (pass.states == NULL || pass.worklist == NULL || pass.queued == NULL || pass.returns == NULL) {
+        pass.failed = true;
+    } else {
+        /* Registers are exact where the run starts. Anything run before, like the
+         * callers of a function entered in the middle, is covered from pc 0 */
+        link_state_t start;
+        for (int i = 0; i < VM_REGISTERS; i++) {
+            start.value[i] = registers[i];
+        }
+        start.known = (1u << VM_REGISTERS) - 1;
+
+        if (entry != 0) {
+            link_entry(&pass, 0);
+        }
+        link_merge(&pass, entry, &start);
+
+        while (pass.pending && !pass.failed) {
+            size_t pc = pass.worklist[--pass.pending];
+            pass.queued[pc] = 0;
+            link_visit(&pass, pc);
+        }
+    }
+
+    size_t linked = 0;
+    for (size_t pc = 0; !pass.failed && pc < prog->code_size; pc++) {
+        decoded_insn_t *in = &prog->insns[pc];
+        int target_reg = link_target_reg(in);
+
+        if (pass.states[pc]) {
+            in->flags |= DECODE_REACHED;
+        }
+
+        if (pass.states[pc] && target_reg >= 0 && in->opcode != OP_SPAWN &&
+            link_known(pass.states[pc], in->regs[target_reg])) {
+            in->imm = pass.states[pc]->value[in->regs[target_reg]];
+            in->flags |= DECODE_STATIC;
+            linked++;
+        }
+    }
+
+    if (pass.states) {
+        for (size_t pc = 0; pc < prog->code_size; pc++) {
+            free(pass.states[pc]);
+        }
+    }
+    free(pass.states);
+    free(pass.worklist);
+    free(pass.queued);
+    free(pass.returns);
+
+    if (pass.failed) {
+        logger_error("Failed to allocate branch analysis, branches are not linked\n");
+        decode_unlink(prog);
+        return;
+    }
+
+    prog->linked = true;
+    logger_print("Linked %zu static branches\n", linked);
+}
+
+/* Forget the analysis, after reached code changed or a jump landed where it assumed nothing */
+void decode_unlink(decoded_program_t *prog) {
+    prog->linked = false;
+
+    for (size_t pc = 0; pc < prog->code_size; pc++) {
+        prog->insns[pc].flags &= ~DECODE_STATIC;
+    }
+}
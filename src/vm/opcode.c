@@ -14,11 +14,15 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 #include "instruction.h"
 #include "logger.h"
 #include "vm.h"
 #include "trap.h"
+#include "thread.h"
+#include "vmem.h"
+#include "fpu.h"
 
 static size_t read_value(vm_t *vm) {
     size_t value = 0;
@@ -29,7 +33,7 @@ static size_t read_value(vm_t *vm) {
 }
 
 inline void op_load_handler(vm_t *vm){
-    uint8_t reg = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
     size_t value = read_value(vm);
     vm->registers[reg] = value;
 
@@ -39,31 +43,33 @@ inline void op_load_handler(vm_t *vm){
 }
 
 inline void op_sa_handler(vm_t *vm){
-    uint8_t reg = vm->memory[vm->pc++] & 0x07;
-    size_t addr = read_value(vm);
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
+    size_t addr = read_value(vm) & vm->memory_mask;
 
-    for (int i = 0; i < 8; i++) {
-        vm->memory[addr + i] = (vm->registers[reg] >> (i * 8)) & 0xFF;
+    if (vm->num_regions && !vm_writable(vm, addr, 8)) {
+        return;
     }
 
+    vm->counters[VM_COUNTER_MEMORY]++;
+    vmem_store(vm->memory + addr, 8, vm->registers[reg]);
+
     logger_print("SA: [%lx] = R%d = %lx\n", addr, reg, vm->registers[reg]);
 }
 
 inline void op_la_handler(vm_t *vm){
-    uint8_t reg = vm->memory[vm->pc++] & 0x07;
-    size_t addr = read_value(vm);
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
+    size_t addr = read_value(vm) & vm->memory_mask;
 
-    vm->registers[reg] = 0;
-    for (int i = 0; i < 8; i++) {
-        vm->registers[reg] |= (size_t)vm->memory[addr + i] << (i * 8);
-    }
+    uint64_t value = vmem_load(vm->memory + addr, 8);
+    vm->counters[VM_COUNTER_MEMORY]++;
+    vm->registers[reg] = value;
 
     logger_print("LA: R%d = %lx = [%lx]\n", reg, vm->registers[reg], addr);
 }
 
 inline void op_mov_handler(vm_t *vm){
-    uint8_t reg_dest = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src = vm->memory[vm->pc++] & vm->register_mask;
     vm->registers[reg_dest] = vm->registers[reg_src];
 
     logger_print("MOV: R%d = R%d = %d\n", 
@@ -73,9 +79,9 @@ inline void op_mov_handler(vm_t *vm){
 }
 
 inline void op_add_handler(vm_t *vm){
-    uint8_t reg_dest = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src1 = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src2 = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src1 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src2 = vm->memory[vm->pc++] & vm->register_mask;
     vm->registers[reg_dest] = vm->registers[reg_src1] + vm->registers[reg_src2];
 
     logger_print("ADD: R%d = R%d + R%d = %d\n", 
@@ -85,9 +91,9 @@ inline void op_add_handler(vm_t *vm){
 }
 
 inline void op_sub_handler(vm_t *vm){
-    uint8_t reg_dest = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src1 = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src2 = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src1 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src2 = vm->memory[vm->pc++] & vm->register_mask;
     vm->registers[reg_dest] = vm->registers[reg_src1] - vm->registers[reg_src2];
 
     logger_print("SUB: R%d = R%d - R%d = %d\n", 
@@ -97,9 +103,9 @@ inline void op_sub_handler(vm_t *vm){
 }
 
 inline void op_multi_handler(vm_t *vm){
-    uint8_t reg_dest = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src1 = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src2 = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src1 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src2 = vm->memory[vm->pc++] & vm->register_mask;
     vm->registers[reg_dest] = vm->registers[reg_src1] * vm->registers[reg_src2];
 
     logger_print("MUL: R%d = R%d * R%d = %d\n", 
@@ -109,9 +115,16 @@ inline void op_multi_handler(vm_t *vm){
 }
 
 inline void op_divide_handler(vm_t *vm){
-    uint8_t reg_dest = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src1 = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src2 = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src1 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src2 = vm->memory[vm->pc++] & vm->register_mask;
+
+    if (vm->registers[reg_src2] == 0) {
+        logger_error("Division by zero at position %zu\n", vm->pc - 4);
+        vm->running = false;
+        return;
+    }
+
     vm->registers[reg_dest] = vm->registers[reg_src1] / vm->registers[reg_src2];
 
     logger_print("DIV: R%d = R%d / R%d = %d\n", 
@@ -121,7 +134,7 @@ inline void op_divide_handler(vm_t *vm){
 }
 
 inline void op_increase_handler(vm_t *vm){
-    uint8_t reg = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
     vm->registers[reg]++;
 
     logger_print("INC: R%d = %d\n", reg, vm->registers[reg]);
@@ -130,7 +143,7 @@ inline void op_increase_handler(vm_t *vm){
 }
 
 inline void op_decrease_handler(vm_t *vm){
-    uint8_t reg = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
     vm->registers[reg]--;
 
     logger_print("DEC: R%d = %d\n", reg, vm->registers[reg]);
@@ -139,9 +152,9 @@ inline void op_decrease_handler(vm_t *vm){
 }
 
 inline void op_and_handler(vm_t *vm){
-    uint8_t reg_dest = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src1 = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src2 = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src1 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src2 = vm->memory[vm->pc++] & vm->register_mask;
     vm->registers[reg_dest] = vm->registers[reg_src1] & vm->registers[reg_src2];
 
     logger_print("AND: R%d = R%d / R%d = %d\n", 
@@ -151,18 +164,18 @@ inline void op_and_handler(vm_t *vm){
 }
 
 inline void op_not_handler(vm_t *vm){
-    uint8_t reg = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
     vm->registers[reg] = !(vm->registers[reg]);
 
-    logger_print("PRT: R%d = %d\n", reg, vm->registers[reg]);
+    logger_print("NOT: R%d = %zu\n", reg, vm->registers[reg]);
 
     return;
 }
 
 inline void op_or_handler(vm_t *vm){
-    uint8_t reg_dest = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src1 = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src2 = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src1 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src2 = vm->memory[vm->pc++] & vm->register_mask;
     vm->registers[reg_dest] = vm->registers[reg_src1] | vm->registers[reg_src2];
 
     logger_print("AND: R%d = R%d / R%d = %d\n", 
@@ -172,9 +185,9 @@ inline void op_or_handler(vm_t *vm){
 }
 
 inline void op_xor_handler(vm_t *vm){
-    uint8_t reg_dest = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src1 = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src2 = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src1 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src2 = vm->memory[vm->pc++] & vm->register_mask;
     vm->registers[reg_dest] = vm->registers[reg_src1] ^ vm->registers[reg_src2];
 
     logger_print("AND: R%d = R%d / R%d = %d\n", 
@@ -184,9 +197,9 @@ inline void op_xor_handler(vm_t *vm){
 }
 
 inline void op_cmp_handler(vm_t *vm){
-    uint8_t reg_dest = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src1 = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_src2 = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src1 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src2 = vm->memory[vm->pc++] & vm->register_mask;
 
     if (vm->registers[reg_src1] == vm->registers[reg_src2]){
         vm->registers[reg_dest] = 1;
@@ -205,8 +218,8 @@ inline void op_cmp_handler(vm_t *vm){
 }
 
 inline void op_jump_handler(vm_t *vm){
-    uint8_t reg = vm->memory[vm->pc++] & 0x07;
-    vm->pc = vm->registers[reg];
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
+    vm_branch(vm, vm->registers[reg]);
 
     logger_print("JMP: R%d = %d\n", reg, vm->registers[reg]);
 
@@ -214,14 +227,14 @@ inline void op_jump_handler(vm_t *vm){
 }
 
 inline void op_jnz_handler(vm_t *vm){
-    uint8_t reg_bool = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_addr = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_bool = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_addr = vm->memory[vm->pc++] & vm->register_mask;
 
     if ((!(vm->registers[reg_bool])) == 1) {
         logger_print("JNZ: R%d is false\n", reg_bool);
     }
     else {
-        vm->pc = vm->registers[reg_addr];
+        vm_branch(vm, vm->registers[reg_addr]);
 
         logger_print("JNZ: JMP %d\n", vm->registers[reg_addr]);
     }
@@ -230,11 +243,11 @@ inline void op_jnz_handler(vm_t *vm){
 }
 
 inline void op_jz_handler(vm_t *vm){
-    uint8_t reg_bool = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_addr = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_bool = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_addr = vm->memory[vm->pc++] & vm->register_mask;
 
     if ((!(vm->registers[reg_bool])) == 1) {
-        vm->pc = vm->registers[reg_addr];
+        vm_branch(vm, vm->registers[reg_addr]);
 
         logger_print("JZ: JMP %d\n", vm->registers[reg_addr]);
     }
@@ -247,8 +260,8 @@ inline void op_jz_handler(vm_t *vm){
 }
 
 inline void op_loop_handler(vm_t *vm){
-    uint8_t reg_counter = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_addr = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg_counter = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_addr = vm->memory[vm->pc++] & vm->register_mask;
 
     if ((!(vm->registers[reg_counter])) == 1) {
         logger_print("LOOP: R%d is false & STOP\n",
@@ -256,7 +269,7 @@ inline void op_loop_handler(vm_t *vm){
     }
     else {
         vm->registers[reg_counter]--;
-        vm->pc = vm->registers[reg_addr];
+        vm_branch(vm, vm->registers[reg_addr]);
 
         logger_print("JNZ: R%d = %d & JMP %d\n",
           reg_counter, vm->registers[reg_counter], vm->registers[reg_addr]);
@@ -266,37 +279,367 @@ inline void op_loop_handler(vm_t *vm){
 }
 
 inline void op_trap_handler(vm_t *vm) {
-    uint8_t reg_num = vm->memory[vm->pc++] & 0x07;
-    uint8_t reg_value = vm->memory[vm->pc++] & 0x07;
-
-    size_t trap_number = vm->registers[reg_num];
-
-    switch (trap_number)
-    {
-        case TRAP_PUTC: {
-            trap_putc(vm, reg_value);
-            break;
-        }
-
-        case TRAP_GETC: {
-            trap_getc(vm, reg_value);
-            break;
-        }
-
-        default: {
-            logger_error("Unknown trap number");
-            break;
-        }
-    }
+    uint8_t reg_num = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_value = vm->memory[vm->pc++] & vm->register_mask;
+
+    trap_call(vm, vm->registers[reg_num], reg_value);
 
     return;
 }
 
 inline void op_print_handler(vm_t *vm){
-    uint8_t reg = vm->memory[vm->pc++] & 0x07;
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
+
+    logger_print("PRT: R%d = %zu\n", reg, vm->registers[reg]);
+
+    return;
+}
+
+inline void op_push_handler(vm_t *vm){
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
+
+    if (vm_push(vm, vm->registers[reg])) {
+        logger_print("PUSH: R%d = %d, SP = %lx\n", reg, vm->registers[reg], vm->sp);
+    }
+
+    return;
+}
+
+inline void op_pop_handler(vm_t *vm){
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
+
+    if (vm_pop(vm, &vm->registers[reg])) {
+        logger_print("POP: R%d = %d, SP = %lx\n", reg, vm->registers[reg], vm->sp);
+    }
+
+    return;
+}
+
+inline void op_call_handler(vm_t *vm){
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
+
+    if (vm_call(vm, vm->registers[reg])) {
+        logger_print("CALL: R%d = %d\n", reg, vm->registers[reg]);
+    }
+
+    return;
+}
+
+inline void op_ret_handler(vm_t *vm){
+    if (vm_return(vm)) {
+        logger_print("RET: %d\n", vm->pc);
+    }
+
+    return;
+}
+
+inline void op_spawn_handler(vm_t *vm){
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_addr = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_stack = vm->memory[vm->pc++] & vm->register_mask;
+
+    if (vm_spawn(vm, vm->registers[reg_addr], vm->registers[reg_stack], reg_dest)) {
+        logger_print("SPAWN: R%d = %d\n", reg_dest, vm->registers[reg_dest]);
+    }
+
+    return;
+}
+
+inline void op_join_handler(vm_t *vm){
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg = vm->memory[vm->pc++] & vm->register_mask;
+
+    if (vm_join(vm, vm->registers[reg], &vm->registers[reg_dest])) {
+        logger_print("JOIN: R%d = %d\n", reg_dest, vm->registers[reg_dest]);
+    }
+
+    return;
+}
+
+static void op_atomic(vm_t *vm, uint8_t opcode){
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_addr = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src = vm->memory[vm->pc++] & vm->register_mask;
+
+    if (vm_atomic(vm, opcode, vm->registers[reg_addr], vm->registers[reg_src], &vm->registers[reg_dest])) {
+        logger_print("%s: R%d = %d\n", instruction_table[opcode].mnemonic, reg_dest, vm->registers[reg_dest]);
+    }
+
+    return;
+}
+
+inline void op_cas_handler(vm_t *vm){
+    op_atomic(vm, OP_CAS);
+}
+
+inline void op_fadd_handler(vm_t *vm){
+    op_atomic(vm, OP_FADD);
+}
+
+inline void op_xchg_handler(vm_t *vm){
+    op_atomic(vm, OP_XCHG);
+}
+
+inline void op_fence_handler(vm_t *vm){
+    vm_fence();
+
+    logger_print("FENCE\n");
+    (void)vm;
+
+    return;
+}
+
+/* Load size bytes at R(base) + offset, sign extended if sign is set */
+static void op_load_sized(vm_t *vm, uint8_t opcode, size_t size, bool sign){
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_base = vm->memory[vm->pc++] & vm->register_mask;
+    size_t addr = (vm->registers[reg_base] + read_value(vm)) & vm->memory_mask;
+
+    uint64_t value = vmem_load(vm->memory + addr, size);
+    vm->counters[VM_COUNTER_MEMORY]++;
+    vm->registers[reg_dest] = sign ? vmem_extend(value, size) : value;
+
+    logger_print("%s: R%d = %zx = [%zx]\n", instruction_table[opcode].mnemonic,
+          reg_dest, vm->registers[reg_dest], addr);
+
+    return;
+}
+
+/* Store the low size bytes of R(src) at R(base) + offset */
+static void op_store_sized(vm_t *vm, uint8_t opcode, size_t size){
+    uint8_t reg_src = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_base = vm->memory[vm->pc++] & vm->register_mask;
+    size_t addr = (vm->registers[reg_base] + read_value(vm)) & vm->memory_mask;
+
+    if (vm->num_regions && !vm_writable(vm, addr, size)) {
+        return;
+    }
+
+    vm->counters[VM_COUNTER_MEMORY]++;
+    vmem_store(vm->memory + addr, size, vm->registers[reg_src]);
+
+    logger_print("%s: [%zx] = R%d = %zx\n", instruction_table[opcode].mnemonic,
+          addr, reg_src, vm->registers[reg_src]);
+
+    return;
+}
+
+inline void op_ldb_handler(vm_t *vm){
+    op_load_sized(vm, OP_LDB, 1, false);
+}
+
+inline void op_ldbs_handler(vm_t *vm){
+    op_load_sized(vm, OP_LDBS, 1, true);
+}
+
+inline void op_ldh_handler(vm_t *vm){
+    op_load_sized(vm, OP_LDH, 2, false);
+}
+
+inline void op_ldhs_handler(vm_t *vm){
+    op_load_sized(vm, OP_LDHS, 2, true);
+}
+
+inline void op_ldw_handler(vm_t *vm){
+    op_load_sized(vm, OP_LDW, 4, false);
+}
+
+inline void op_ldws_handler(vm_t *vm){
+    op_load_sized(vm, OP_LDWS, 4, true);
+}
+
+inline void op_ldq_handler(vm_t *vm){
+    op_load_sized(vm, OP_LDQ, 8, false);
+}
+
+inline void op_stb_handler(vm_t *vm){
+    op_store_sized(vm, OP_STB, 1);
+}
+
+inline void op_sth_handler(vm_t *vm){
+    op_store_sized(vm, OP_STH, 2);
+}
+
+inline void op_stw_handler(vm_t *vm){
+    op_store_sized(vm, OP_STW, 4);
+}
+
+inline void op_stq_handler(vm_t *vm){
+    op_store_sized(vm, OP_STQ, 8);
+}
+
+/* Result of the comparison of a set or compare and branch instruction */
+static bool op_condition(uint8_t opcode, size_t a, size_t b){
+    switch (opcode) {
+        case OP_SLT: case OP_BLT: return (int64_t)a < (int64_t)b;
+        case OP_SLTU: case OP_BLTU: return a < b;
+        case OP_SLE: return (int64_t)a <= (int64_t)b;
+        case OP_SLEU: return a <= b;
+        case OP_BEQ: return a == b;
+        case OP_BNE: return a != b;
+        default: return false;
+    }
+}
+
+static void op_set(vm_t *vm, uint8_t opcode){
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src1 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src2 = vm->memory[vm->pc++] & vm->register_mask;
+    vm->registers[reg_dest] = op_condition(opcode, vm->registers[reg_src1], vm->registers[reg_src2]);
+
+    logger_print("%s: R%d = R%d R%d = %zu\n", instruction_table[opcode].mnemonic,
+          reg_dest, reg_src1, reg_src2, vm->registers[reg_dest]);
+
+    return;
+}
+
+inline void op_slt_handler(vm_t *vm){
+    op_set(vm, OP_SLT);
+}
+
+inline void op_sltu_handler(vm_t *vm){
+    op_set(vm, OP_SLTU);
+}
+
+inline void op_sle_handler(vm_t *vm){
+    op_set(vm, OP_SLE);
+}
+
+inline void op_sleu_handler(vm_t *vm){
+    op_set(vm, OP_SLEU);
+}
+
+inline void op_sel_handler(vm_t *vm){
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_cond = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src = vm->memory[vm->pc++] & vm->register_mask;
+
+    if (vm->registers[reg_cond]) {
+        vm->registers[reg_dest] = vm->registers[reg_src];
+    }
+
+    logger_print("SEL: R%d = R%d ? R%d = %zu\n", reg_dest, reg_cond, reg_src, vm->registers[reg_dest]);
+
+    return;
+}
+
+static void op_branch(vm_t *vm, uint8_t opcode){
+    uint8_t reg_src1 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src2 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_addr = vm->memory[vm->pc++] & vm->register_mask;
+
+    if (op_condition(opcode, vm->registers[reg_src1], vm->registers[reg_src2])) {
+        vm_branch(vm, vm->registers[reg_addr]);
+
+        logger_print("%s: JMP %zu\n", instruction_table[opcode].mnemonic, vm->pc);
+    } else {
+        logger_print("%s: R%d R%d not taken\n", instruction_table[opcode].mnemonic, reg_src1, reg_src2);
+    }
 
-    logger_print("PRT: R%d = %d\n", reg, vm->registers[reg]);
+    return;
+}
+
+inline void op_beq_handler(vm_t *vm){
+    op_branch(vm, OP_BEQ);
+}
+
+inline void op_bne_handler(vm_t *vm){
+    op_branch(vm, OP_BNE);
+}
+
+inline void op_blt_handler(vm_t *vm){
+    op_branch(vm, OP_BLT);
+}
+
+inline void op_bltu_handler(vm_t *vm){
+    op_branch(vm, OP_BLTU);
+}
+
+/* Binary64 operation on R(src1) and R(src2), see fpu.h */
+static void op_float(vm_t *vm, uint8_t opcode){
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src1 = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src2 = vm->memory[vm->pc++] & vm->register_mask;
+    double a = fpu_double(vm->registers[reg_src1]);
+    double b = fpu_double(vm->registers[reg_src2]);
+    size_t *dest = &vm->registers[reg_dest];
+
+    switch (opcode) {
+        case OP_FADDD: *dest = fpu_bits(a + b); break;
+        case OP_FSUBD: *dest = fpu_bits(a - b); break;
+        case OP_FMULD: *dest = fpu_bits(a * b); break;
+        case OP_FDIVD: *dest = fpu_bits(a / b); break;
+        case OP_FMAD: *dest = fpu_bits(fma(a, b, fpu_double(*dest))); break;
+        case OP_FEQD: *dest = (a == b); break;
+        case OP_FLTD: *dest = (a < b); break;
+        case OP_FLED: *dest = (a <= b); break;
+        default: break;
+    }
+
+    logger_print("%s: R%d = R%d R%d = %zx\n", instruction_table[opcode].mnemonic,
+          reg_dest, reg_src1, reg_src2, *dest);
 
     return;
 }
 
+inline void op_faddd_handler(vm_t *vm){
+    op_float(vm, OP_FADDD);
+}
+
+inline void op_fsubd_handler(vm_t *vm){
+    op_float(vm, OP_FSUBD);
+}
+
+inline void op_fmuld_handler(vm_t *vm){
+    op_float(vm, OP_FMULD);
+}
+
+inline void op_fdivd_handler(vm_t *vm){
+    op_float(vm, OP_FDIVD);
+}
+
+inline void op_fmad_handler(vm_t *vm){
+    op_float(vm, OP_FMAD);
+}
+
+inline void op_feqd_handler(vm_t *vm){
+    op_float(vm, OP_FEQD);
+}
+
+inline void op_fltd_handler(vm_t *vm){
+    op_float(vm, OP_FLTD);
+}
+
+inline void op_fled_handler(vm_t *vm){
+    op_float(vm, OP_FLED);
+}
+
+inline void op_fsqrtd_handler(vm_t *vm){
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src = vm->memory[vm->pc++] & vm->register_mask;
+    vm->registers[reg_dest] = fpu_bits(sqrt(fpu_double(vm->registers[reg_src])));
+
+    logger_print("FSQRTD: R%d = R%d = %zx\n", reg_dest, reg_src, vm->registers[reg_dest]);
+
+    return;
+}
+
+inline void op_itof_handler(vm_t *vm){
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src = vm->memory[vm->pc++] & vm->register_mask;
+    vm->registers[reg_dest] = fpu_bits((double)(int64_t)vm->registers[reg_src]);
+
+    logger_print("ITOF: R%d = R%d = %zx\n", reg_dest, reg_src, vm->registers[reg_dest]);
+
+    return;
+}
+
+inline void op_ftoi_handler(vm_t *vm){
+    uint8_t reg_dest = vm->memory[vm->pc++] & vm->register_mask;
+    uint8_t reg_src = vm->memory[vm->pc++] & vm->register_mask;
+    vm->registers[reg_dest] = fpu_to_int(fpu_double(vm->registers[reg_src]));
+
+    logger_print("FTOI: R%d = R%d = %zx\n", reg_dest, reg_src, vm->registers[reg_dest]);
+
+    return;
+}
@@ -0,0 +1,288 @@
+/* 
+ *
+ *      thread.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if !defined(_WIN32)
+    #include <pthread.h>
+#endif
+
+#include "instruction.h"
+#include "logger.h"
+#include "vm.h"
+#include "decode.h"
+#include "thread.h"
+
+#if !defined(_WIN32)
+
+/* Guest thread, runs on its own copy of the VM state */
+struct vm_thread {
+    pthread_t handle;
+    vm_t vm;
+    bool joined;
+};
+
+/* Threads of a VM, shared by all of them */
+struct vm_threads {
+    pthread_mutex_t lock;
+    struct vm_thread **list;    // Thread n is list[n - 1]
+    size_t count;
+    size_t capacity;
+};
+
+static void *vm_thread_main(void *arg) {
+    vm_t *vm = (vm_t *)arg;
+
+    /* Same engine as the thread that spawned it */
+    if (vm->program) {
+        vm_run_decoded(vm, vm->program);
+    } else {
+        vm_run(vm);
+    }
+
+    return NULL;
+}
+
+/* Start a thread at entry with a copy of the registers and its own stack
+ * ending at stack. R(reg) is the thread id in the caller and 0 in the thread */
+bool vm_spawn(vm_t *vm, size_t entry, size_t stack, uint8_t reg) {
+    size_t stack_size = vm->stack_top - vm->stack_base;
+
+    if ((stack & 7) != 0 || stack > vm->memory_size || stack < stack_size) {
+        logger_error("Invalid thread stack 0x%zx at position %zu\n", stack, vm->pc);
+        vm->running = false;
+        return false;
+    }
+
+    if (vm->threads == NULL) {
+        vm->threads = (struct vm_threads *)calloc(1, sizeof(struct vm_threads));
+        if (vm->threads == NULL) {
+            logger_error("Failed to allocate threads\n");
+            vm->running = false;
+            return false;
+        }
+        pthread_mutex_init(&vm->threads->lock, NULL);
+    }
+
+    struct vm_threads *threads = vm->threads;
+    struct vm_thread *thread = (struct vm_thread *)calloc(1, sizeof(struct vm_thread));
+    if (thread == NULL) {
+        logger_error("Failed to allocate thread\n");
+        vm->running = false;
+        return false;
+    }
+
+    pthread_mutex_lock(&threads->lock);
+
+    if (threads->count == threads->capacity) {
+        size_t capacity = threads->capacity ? threads->capacity * 2 : 8;
+        struct vm_thread **list = (struct vm_thread **)realloc(threads->list, capacity * sizeof(*list));
+        if (list == NULL) {
+            pthread_mutex_unlock(&threads->lock);
+            free(thread);
+            logger_error("Failed to allocate thread\n");
+            vm->running = false;
+            return false;
+        }
+        threads->list = list;
+        threads->capacity = capacity;
+    }
+
+    size_t id = threads->count + 1;
+
+    thread->vm = *vm;
+    thread->vm.thread_id = id;
+    thread->vm.pc = entry;
+    thread->vm.insn_pc = entry;
+    thread->vm.registers[reg] = 0;
+    thread->vm.stack_top = stack;
+    thread->vm.stack_base = stack - stack_size;
+    thread->vm.sp = stack;
+    thread->vm.ras_depth = 0;
+    thread->vm.memory_fd = -1;
+    memset(thread->vm.counters, 0, sizeof(thread->vm.counters));
+
+    /* A thread gets what is left of the budget of its parent, so a spinning thread cannot run forever */
+    uint64_t count = vm->counters[VM_COUNTER_INSTRUCTIONS];
+    thread->vm.budget = (vm->budget == 0) ? 0 : (vm->budget > count) ? vm->budget - count : 1;
+    thread->vm.watch_pending = false;
+
+    /* Creating the thread publishes all earlier writes of the caller to it */
+    if (pthread_create(&thread->handle, NULL, vm_thread_main, &thread->vm) != 0) {
+        pthread_mutex_unlock(&threads->lock);
+        free(thread);
+        logger_error("Failed to start thread at position %zu\n", vm->pc);
+        vm->running = false;
+        return false;
+    }
+
+    threads->list[threads->count++] = thread;
+    pthread_mutex_unlock(&threads->lock);
+
+    vm->registers[reg] = id;
+
+    return true;
+}
+
+/* Take a thread out of the table for joining, NULL if unknown or already joined */
+static struct vm_thread *vm_thread_claim(struct vm_threads *threads, size_t id) {
+    struct vm_thread *thread = NULL;
+
+    pthread_mutex_lock(&threads->lock);
+    if (id >= 1 && id <= threads->count && !threads->list[id - 1]->joined) {
+        thread = threads->list[id - 1];
+        thread->joined = true;
+    }
+    pthread_mutex_unlock(&threads->lock);
+
+    return thread;
+}
+
+/* Wait for a thread, value is its R0. A fault in the thread stops the caller too */
+bool vm_join(vm_t *vm, size_t id, size_t *value) {
+    struct vm_thread *thread = (vm->threads && id != vm->thread_id) ? vm_thread_claim(vm->threads, id) : NULL;
+
+    if (thread == NULL) {
+        logger_error("Invalid thread %zu at position %zu\n", id, vm->pc);
+        vm->running = false;
+        return false;
+    }
+
+    pthread_join(thread->handle, NULL);
+
+    if (vm_status(&thread->vm) != 0) {
+        logger_error("Thread %zu stopped by an error\n", id);
+        vm->running = false;
+        return false;
+    }
+
+    *value = thread->vm.registers[0];
+
+    return true;
+}
+
+/* Wait for every thread not joined by the guest */
+void vm_join_all(vm_t *vm) {
+    struct vm_threads *threads = vm->threads;
+    if (threads == NULL) {
+        return;
+    }
+
+    /* Threads may still spawn more while we wait */
+    while (1) {
+        struct vm_thread *thread = NULL;
+
+        pthread_mutex_lock(&threads->lock);
+        for (size_t i = 0; i < threads->count; i++) {
+            if (!threads->list[i]->joined) {
+                thread = threads->list[i];
+                thread->joined = true;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&threads->lock);
+
+        if (thread == NULL) {
+            break;
+        }
+
+        pthread_join(thread->handle, NULL);
+    }
+}
+
+void vm_threads_free(vm_t *vm) {
+    struct vm_threads *threads = vm->threads;
+    if (threads == NULL || vm->thread_id != 0) {
+        return;
+    }
+
+    vm_join_all(vm);
+
+    for (size_t i = 0; i < threads->count; i++) {
+        free(threads->list[i]);
+    }
+    free(threads->list);
+    pthread_mutex_destroy(&threads->lock);
+    free(threads);
+
+    vm->threads = NULL;
+}
+
+#else
+
+bool vm_spawn(vm_t *vm, size_t entry, size_t stack, uint8_t reg) {
+    (void)entry; (void)stack; (void)reg;
+    logger_error("Threads are not supported on this platform\n");
+    vm->running = false;
+    return false;
+}
+
+bool vm_join(vm_t *vm, size_t id, size_t *value) {
+    (void)value;
+    logger_error("Invalid thread %zu at position %zu\n", id, vm->pc);
+    vm->running = false;
+    return false;
+}
+
+void vm_join_all(vm_t *vm) {
+    (void)vm;
+}
+
+void vm_threads_free(vm_t *vm) {
+    (void)vm;
+}
+
+#endif
+
+/* Atomic read-modify-write of an aligned 8 bytes word, sequentially consistent.
+ * For CAS, result holds the expected value and receives the old value */
+bool vm_atomic(vm_t *vm, uint8_t opcode, size_t addr, size_t value, size_t *result) {
+    if ((addr & 7) != 0 || vm->memory_size < 8 || addr > vm->memory_size - 8) {
+        logger_error("Invalid atomic access to 0x%zx at position %zu\n", addr, vm->pc);
+        vm->running = false;
+        return false;
+    }
+
+    if (vm->num_regions && !vm_writable(vm, addr, 8)) {
+        return false;
+    }
+
+    _Atomic uint64_t *word = (_Atomic uint64_t *)(vm->memory + addr);
+    vm->counters[VM_COUNTER_MEMORY]++;
+
+    switch (opcode) {
+        case OP_CAS: {
+            uint64_t expected = *result;
+            atomic_compare_exchange_strong(word, &expected, (uint64_t)value);
+            *result = (size_t)expected;
+            break;
+        }
+
+        case OP_FADD: *result = (size_t)atomic_fetch_add(word, (uint64_t)value); break;
+        case OP_XCHG: *result = (size_t)atomic_exchange(word, (uint64_t)value); break;
+
+        default: return false;
+    }
+
+    decode_written(vm, addr, 8);
+
+    return true;
+}
+
+void vm_fence(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+}
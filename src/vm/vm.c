@@ -17,68 +17,361 @@
 #include <string.h>
 #include <stdlib.h>
 
+#if !defined(_WIN32)
+    #include <unistd.h>
+    #include <sys/stat.h>
+#endif
+
 #include "instruction.h"
 #include "logger.h"
 #include "vm.h"
+#include "bytecode.h"
+#include "vmem.h"
+#include "thread.h"
+#include "perf.h"
+#include "sample.h"
+#include "metrics.h"
+#include "guard.h"
+#include "watch.h"
 
 /* Initialize VM */
 void vm_init(vm_t *vm, uint8_t *code, size_t code_size, size_t memsize) {
-    memset(vm->registers, 0, sizeof(vm->registers));
-
-    uint8_t *memory = (uint8_t *)malloc(sizeof(uint8_t) * memsize);
+    // Zero filled, pages are only backed once touched
+    uint8_t *memory = vmem_alloc(memsize);
     if (memory == NULL) {
         logger_error("Failed to allocate VM memory\n");
         exit(1);
     }
-    memset(memory, 0x00, sizeof(uint8_t) * memsize);
+
+    vm_init_memory(vm, memory, code, code_size, memsize);
+}
+
+/* Initialize VM on zero filled memory owned by the caller */
+void vm_init_memory(vm_t *vm, uint8_t *memory, uint8_t *code, size_t code_size, size_t memsize) {
+    memset(vm->registers, 0, sizeof(vm->registers));
     
     // Copy byte code at the start of memory
     size_t copy_size = (code_size < memsize) ? code_size : memsize;
     memcpy(memory, code, copy_size);
 
-    // Write memory.map
-    FILE* fp = fopen("memory.map", "wb");
-    if (fp) {
-        fwrite(memory, sizeof(uint8_t), memsize, fp);
-        fclose(fp);
+    vm->memory = memory;
+    vm->pc = 0;
+    vm->insn_pc = 0;
+    vm->running = true;
+    vm->code_size = code_size;
+    vm_set_version(vm, BYTECODE_VERSION);
+    vm->memory_size = memsize;
+    vm->memory_mask = vmem_mask(memsize);
+
+    // Stack region at the top of memory
+    size_t stack_size = (memsize / 4 < VM_STACK_SIZE) ? memsize / 4 : VM_STACK_SIZE;
+    vm->stack_top = memsize & ~(size_t)7;
+    vm->stack_base = (vm->stack_top - stack_size) & ~(size_t)7;
+    vm->sp = vm->stack_top;
+    vm->ras_depth = 0;
+
+    vm->snapshot_path = NULL;
+    vm->memory_fd = -1;
+
+    vm->input = stdin;
+    vm->output = stdout;
+    vm->halted = false;
+
+    vm->threads = NULL;
+    vm->thread_id = 0;
+    vm->program = NULL;
+    memset(vm->channels, 0, sizeof(vm->channels));
+
+    for (int i = 0; i < VM_FILES; i++) {
+        vm->files[i] = -1;
+    }
+    vm->num_regions = 0;
+    vm->perf = false;
+    vm->metrics = NULL;
+    memset(vm->counters, 0, sizeof(vm->counters));
+    vm->budget = 0;
+    vm->paused = false;
+    vm->watches = NULL;
+    vm->watch_pending = false;
+    vm->coverage = NULL;
+    vm_schedule(vm);
+}
+
+/* Run the code as byte code of an ISA version, vm_init assumes the current one */
+void vm_set_version(vm_t *vm, uint32_t version) {
+    vm->version = version;
+    vm->register_mask = vm_register_mask(version);
+}
+
+/* Exit status of a stopped VM, 0 unless it was stopped by an error */
+int vm_status(const vm_t *vm) {
+    return (vm->running || vm->halted || vm->paused) ? 0 : 1;
+}
+
+/* Give the guest a host fd, returns its guest file number or -1 if the table is full */
+int vm_add_file(vm_t *vm, int fd) {
+    for (int i = 3; i < VM_FILES; i++) {
+        if (vm->files[i] < 0) {
+            vm->files[i] = fd;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Map a host file over guest memory, private copy-on-write or read-only.
+ * The size is cut at the end of the file, returns the size mapped or 0 on failure */
+size_t vm_map_file(vm_t *vm, size_t addr, size_t size, int fd, uint64_t offset, bool writable) {
+    #if defined(_WIN32)
+        (void)vm; (void)addr; (void)size; (void)fd; (void)offset; (void)writable;
+        return 0;
+    #else
+        size_t page_size = vmem_page_size();
+        struct stat st;
+
+        if (fd < 0 || fstat(fd, &st) != 0 || (uint64_t)st.st_size <= offset) {
+            return 0;
+        }
+        if ((uint64_t)st.st_size - offset < size) {
+            size = (size_t)((uint64_t)st.st_size - offset);
+        }
+
+        /* Whole pages, outside the code and not over another file */
+        size_t rounded = vmem_round(size);
+        if (size == 0 || addr % page_size != 0 || offset % page_size != 0 || addr < vm->code_size ||
+            addr > vm->memory_size || rounded > vmem_round(vm->memory_size) - addr ||
+            vm->num_regions == VM_REGIONS) {
+            return 0;
+        }
+
+        for (size_t i = 0; i < vm->num_regions; i++) {
+            if (addr < vm->regions[i].addr + vm->regions[i].size && vm->regions[i].addr < addr + rounded) {
+                return 0;
+            }
+        }
+
+        if (!vmem_map_file(vm->memory + addr, size, fd, offset, writable)) {
+            return 0;
+        }
+
+        vm->regions[vm->num_regions++] = (vm_region_t){ addr, rounded, writable };
+
+        return size;
+    #endif
+}
+
+/* Put zero filled memory back in place of the file mapped at addr */
+bool vm_unmap_file(vm_t *vm, size_t addr) {
+    for (size_t i = 0; i < vm->num_regions; i++) {
+        if (vm->regions[i].addr == addr) {
+            if (!vmem_map_zero(vm->memory + addr, vm->regions[i].size)) {
+                return false;
+            }
+
+            vm->regions[i] = vm->regions[--vm->num_regions];
+            return true;
+        }
+    }
+
+    return false;
+}
 
+void vm_unmap_files(vm_t *vm) {
+    while (vm->num_regions > 0) {
+        if (!vm_unmap_file(vm, vm->regions[0].addr)) {
+            break;
+        }
+    }
+}
+
+/* Check a guest store does not hit a read-only file, stops the VM if it does */
+bool vm_writable(vm_t *vm, size_t addr, size_t size) {
+    for (size_t i = 0; i < vm->num_regions; i++) {
+        const vm_region_t *region = &vm->regions[i];
+
+        if (!region->writable && addr < region->addr + region->size && region->addr < addr + size) {
+            logger_error("Write to read-only memory 0x%zx at position %zu\n", addr, vm->pc);
+            vm->running = false;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Release VM memory */
+void vm_destroy(vm_t *vm) {
+    vm_threads_free(vm);
+    vm_unwatch_all(vm);
+
+    vmem_free(vm->memory, vm->memory_size);
+    vm->memory = NULL;
+
+    #if !defined(_WIN32)
+        if (vm->memory_fd >= 0) {
+            close(vm->memory_fd);
+        }
+    #endif
+    vm->memory_fd = -1;
+}
+
+/* Create a VM sharing the memory of a template copy-on-write, with its own
+ * registers and pc. The first clone freezes the template memory in a shared
+ * file, later writes by the template are private and not seen by new clones.
+ * A clone starts without a decoded program, channels or metrics slot, which
+ * belong to one VM. Guest files stay shared, their fds are owned by the host */
+bool vm_clone(vm_t *clone, vm_t *template_vm) {
+    if (template_vm->memory_fd < 0) {
+        template_vm->memory_fd = vmem_share(template_vm->memory, template_vm->memory_size);
+    }
+
+    uint8_t *memory = NULL;
+    if (template_vm->memory_fd >= 0) {
+        memory = vmem_map_shared(template_vm->memory_fd, template_vm->memory_size);
+    }
+
+    /* No shareable memory on this platform, copy it */
+    if (memory == NULL) {
+        memory = vmem_alloc(template_vm->memory_size);
+        if (memory == NULL) {
+            logger_error("Failed to allocate VM memory\n");
+            return false;
+        }
+        memcpy(memory, template_vm->memory, template_vm->memory_size);
+    }
+
+    *clone = *template_vm;
+    clone->memory = memory;
+    clone->memory_fd = -1;
+    clone->threads = NULL;
+    clone->program = NULL;
+    memset(clone->channels, 0, sizeof(clone->channels));
+    clone->metrics = NULL;
+    clone->watches = NULL;
+    clone->watch_pending = false;
+    clone->thread_id = 0;
+    memset(clone->counters, 0, sizeof(clone->counters));
+
+    return true;
+}
+
+/* Push a value to the stack */
+bool vm_push(vm_t *vm, size_t value) {
+    if (vm->sp < vm->stack_base + 8 || vm->sp > vm->stack_top) {
         #if defined(_WIN32)
-            logger_print("Memory map written: %lld bytes (filled with 0x00 + code at start)\n", memsize);
+            logger_error("Stack overflow at position %lld\n", vm->pc);
         #else
-            logger_print("Memory map written: %ld bytes (filled with 0x00 + code at start)\n", memsize);
+            logger_error("Stack overflow at position %ld\n", vm->pc);
         #endif
-    } else {
-        logger_error("Failed to create memory.map file\n");
+
+        vm->running = false;
+        return false;
     }
 
-    vm->memory = memory;
-    vm->pc = 0;
-    vm->running = true;
-    vm->code_size = code_size;
-    vm->memory_size = memsize;
+    if (vm->num_regions && !vm_writable(vm, vm->sp - 8, 8)) {
+        return false;
+    }
+
+    vm->sp -= 8;
+    vm->counters[VM_COUNTER_MEMORY]++;
+    for (int i = 0; i < 8; i++) {
+        vm->memory[vm->sp + i] = (value >> (i * 8)) & 0xFF;
+    }
+
+    return true;
+}
+
+/* Pop a value from the stack */
+bool vm_pop(vm_t *vm, size_t *value) {
+    if (vm->sp < vm->stack_base || vm->sp + 8 > vm->stack_top) {
+        #if defined(_WIN32)
+            logger_error("Stack underflow at position %lld\n", vm->pc);
+        #else
+            logger_error("Stack underflow at position %ld\n", vm->pc);
+        #endif
+
+        vm->running = false;
+        return false;
+    }
+
+    *value = 0;
+    vm->counters[VM_COUNTER_MEMORY]++;
+    for (int i = 0; i < 8; i++) {
+        *value |= (size_t)vm->memory[vm->sp + i] << (i * 8);
+    }
+    vm->sp += 8;
+
+    return true;
+}
+
+/* Call subroutine, pc must point after the CALL instruction */
+bool vm_call(vm_t *vm, size_t addr) {
+    if (!vm_push(vm, vm->pc)) {
+        return false;
+    }
+
+    /* Shadow copy of the return address, used to predict RET */
+    if (vm->ras_depth < VM_RAS_DEPTH) {
+        vm->ras[vm->ras_depth] = vm->pc;
+    }
+    vm->ras_depth++;
+
+    vm_branch(vm, addr);
+
+    return true;
+}
+
+/* Return from subroutine */
+bool vm_return(vm_t *vm) {
+    size_t addr;
+
+    if (!vm_pop(vm, &addr)) {
+        return false;
+    }
+
+    /* Guest rewrote its return address, shadow stack is no longer valid */
+    if (vm->ras_depth > 0) {
+        vm->ras_depth--;
+        if (vm->ras_depth < VM_RAS_DEPTH && vm->ras[vm->ras_depth] != addr) {
+            vm->ras_depth = 0;
+        }
+    }
+
+    vm_branch(vm, addr);
+
+    return true;
 }
 
 /* Execute an instruction */
 void vm_execute(vm_t *vm) {
     if (vm->pc >= vm->code_size) {
         vm->running = false;
+        vm->halted = true;
 
         logger_print("HLT: Reached end of program\n");
         return;
     }
     
+    if (vm->counters[VM_COUNTER_INSTRUCTIONS] == vm->event_at && !vm_event(vm)) {
+        return;
+    }
+
+    vm->insn_pc = vm->pc;
     uint8_t opcode = vm->memory[vm->pc++];
+    vm->counters[VM_COUNTER_INSTRUCTIONS]++;
     
     switch (opcode) {
         case OP_HALT: {
             vm->running = false;
+            vm->halted = true;
 
             logger_print("HLT: Program terminated\n");
             break;
         }
         
         case OP_LOAD: {
-            if (vm->pc + 1 >= vm->code_size) {
+            if (vm->pc + 8 >= vm->code_size) {
                 logger_error("Incomplete LOAD instruction\n");
                 vm->running = false;
                 break;
@@ -90,8 +383,8 @@ void vm_execute(vm_t *vm) {
         }
 
         case OP_LA: {
-            if (vm->pc + 1 >= vm->code_size) {
-                logger_error("Incomplete LOAD instruction\n");
+            if (vm->pc + 8 >= vm->code_size) {
+                logger_error("Incomplete LA instruction\n");
                 vm->running = false;
                 break;
             }
@@ -102,8 +395,8 @@ void vm_execute(vm_t *vm) {
         }
 
         case OP_SA: {
-            if (vm->pc + 1 >= vm->code_size) {
-                logger_error("Incomplete LOAD instruction\n");
+            if (vm->pc + 8 >= vm->code_size) {
+                logger_error("Incomplete SA instruction\n");
                 vm->running = false;
                 break;
             }
@@ -151,22 +444,24 @@ void vm_execute(vm_t *vm) {
 
         case OP_MULTI: {
             if (vm->pc + 2 >= vm->code_size) {
-                logger_error("Incomplete ADD instruction\n");
+                logger_error("Incomplete MUL instruction\n");
                 vm->running = false;
                 break;
             }
 
+            op_multi_handler(vm);
+
             break;
         }
 
         case OP_DIVIDE: {
             if (vm->pc + 2 >= vm->code_size) {
-                logger_error("Incomplete ADD instruction\n");
+                logger_error("Incomplete DIV instruction\n");
                 vm->running = false;
                 break;
             }
 
-            op_multi_handler(vm);
+            op_divide_handler(vm);
 
             break;
         }
@@ -244,8 +539,8 @@ void vm_execute(vm_t *vm) {
         }
         
         case OP_CMP: {
-            if (vm->pc + 2) {
-                logger_error("Incomplete PRINT instruction\n");
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete CMP instruction\n");
                 vm->running = false;
                 break;
             }
@@ -326,6 +621,486 @@ void vm_execute(vm_t *vm) {
 
             break;
         }
+
+        case OP_PUSH: {
+            if (vm->pc >= vm->code_size) {
+                logger_error("Incomplete PUSH instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_push_handler(vm);
+
+            break;
+        }
+
+        case OP_POP: {
+            if (vm->pc >= vm->code_size) {
+                logger_error("Incomplete POP instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_pop_handler(vm);
+
+            break;
+        }
+
+        case OP_CALL: {
+            if (vm->pc >= vm->code_size) {
+                logger_error("Incomplete CALL instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_call_handler(vm);
+
+            break;
+        }
+
+        case OP_RET: {
+            op_ret_handler(vm);
+
+            break;
+        }
+
+        case OP_SPAWN: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete SPAWN instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_spawn_handler(vm);
+
+            break;
+        }
+
+        case OP_JOIN: {
+            if (vm->pc + 1 >= vm->code_size) {
+                logger_error("Incomplete JOIN instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_join_handler(vm);
+
+            break;
+        }
+
+        case OP_CAS: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete CAS instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_cas_handler(vm);
+
+            break;
+        }
+
+        case OP_FADD: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete FADD instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_fadd_handler(vm);
+
+            break;
+        }
+
+        case OP_XCHG: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete XCHG instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_xchg_handler(vm);
+
+            break;
+        }
+
+        case OP_FENCE: {
+            op_fence_handler(vm);
+
+            break;
+        }
+
+        case OP_LDB: {
+            if (vm->pc + 9 >= vm->code_size) {
+                logger_error("Incomplete LDB instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_ldb_handler(vm);
+
+            break;
+        }
+
+        case OP_LDBS: {
+            if (vm->pc + 9 >= vm->code_size) {
+                logger_error("Incomplete LDBS instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_ldbs_handler(vm);
+
+            break;
+        }
+
+        case OP_LDH: {
+            if (vm->pc + 9 >= vm->code_size) {
+                logger_error("Incomplete LDH instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_ldh_handler(vm);
+
+            break;
+        }
+
+        case OP_LDHS: {
+            if (vm->pc + 9 >= vm->code_size) {
+                logger_error("Incomplete LDHS instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_ldhs_handler(vm);
+
+            break;
+        }
+
+        case OP_LDW: {
+            if (vm->pc + 9 >= vm->code_size) {
+                logger_error("Incomplete LDW instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_ldw_handler(vm);
+
+            break;
+        }
+
+        case OP_LDWS: {
+            if (vm->pc + 9 >= vm->code_size) {
+                logger_error("Incomplete LDWS instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_ldws_handler(vm);
+
+            break;
+        }
+
+        case OP_LDQ: {
+            if (vm->pc + 9 >= vm->code_size) {
+                logger_error("Incomplete LDQ instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_ldq_handler(vm);
+
+            break;
+        }
+
+        case OP_STB: {
+            if (vm->pc + 9 >= vm->code_size) {
+                logger_error("Incomplete STB instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_stb_handler(vm);
+
+            break;
+        }
+
+        case OP_STH: {
+            if (vm->pc + 9 >= vm->code_size) {
+                logger_error("Incomplete STH instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_sth_handler(vm);
+
+            break;
+        }
+
+        case OP_STW: {
+            if (vm->pc + 9 >= vm->code_size) {
+                logger_error("Incomplete STW instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_stw_handler(vm);
+
+            break;
+        }
+
+        case OP_STQ: {
+            if (vm->pc + 9 >= vm->code_size) {
+                logger_error("Incomplete STQ instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_stq_handler(vm);
+
+            break;
+        }
+
+        case OP_SLT: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete SLT instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_slt_handler(vm);
+
+            break;
+        }
+
+        case OP_SLTU: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete SLTU instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_sltu_handler(vm);
+
+            break;
+        }
+
+        case OP_SLE: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete SLE instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_sle_handler(vm);
+
+            break;
+        }
+
+        case OP_SLEU: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete SLEU instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_sleu_handler(vm);
+
+            break;
+        }
+
+        case OP_SEL: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete SEL instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_sel_handler(vm);
+
+            break;
+        }
+
+        case OP_BEQ: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete BEQ instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_beq_handler(vm);
+
+            break;
+        }
+
+        case OP_BNE: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete BNE instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_bne_handler(vm);
+
+            break;
+        }
+
+        case OP_BLT: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete BLT instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_blt_handler(vm);
+
+            break;
+        }
+
+        case OP_BLTU: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete BLTU instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_bltu_handler(vm);
+
+            break;
+        }
+
+        case OP_FADDD: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete FADDD instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_faddd_handler(vm);
+
+            break;
+        }
+
+        case OP_FSUBD: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete FSUBD instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_fsubd_handler(vm);
+
+            break;
+        }
+
+        case OP_FMULD: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete FMULD instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_fmuld_handler(vm);
+
+            break;
+        }
+
+        case OP_FDIVD: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete FDIVD instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_fdivd_handler(vm);
+
+            break;
+        }
+
+        case OP_FMAD: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete FMAD instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_fmad_handler(vm);
+
+            break;
+        }
+
+        case OP_FSQRTD: {
+            if (vm->pc + 1 >= vm->code_size) {
+                logger_error("Incomplete FSQRTD instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_fsqrtd_handler(vm);
+
+            break;
+        }
+
+        case OP_FEQD: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete FEQD instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_feqd_handler(vm);
+
+            break;
+        }
+
+        case OP_FLTD: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete FLTD instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_fltd_handler(vm);
+
+            break;
+        }
+
+        case OP_FLED: {
+            if (vm->pc + 2 >= vm->code_size) {
+                logger_error("Incomplete FLED instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_fled_handler(vm);
+
+            break;
+        }
+
+        case OP_ITOF: {
+            if (vm->pc + 1 >= vm->code_size) {
+                logger_error("Incomplete ITOF instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_itof_handler(vm);
+
+            break;
+        }
+
+        case OP_FTOI: {
+            if (vm->pc + 1 >= vm->code_size) {
+                logger_error("Incomplete FTOI instruction\n");
+                vm->running = false;
+                break;
+            }
+
+            op_ftoi_handler(vm);
+
+            break;
+        }
         
         default: {
             #if defined(_WIN32)
@@ -341,15 +1116,84 @@ void vm_execute(vm_t *vm) {
     }
 }
 
+/* Called before an instruction once the instruction count reaches event_at:
+ * publishes metrics and pauses at the budget. False if the VM must stop */
+bool vm_event(vm_t *vm) {
+    uint64_t count = vm->counters[VM_COUNTER_INSTRUCTIONS];
+
+    if (vm->watch_pending) {
+        vm_watch_check(vm);
+    }
+
+    if (vm->metrics) {
+        metrics_publish(vm);
+    }
+
+    if (vm->budget && count >= vm->budget) {
+        vm->paused = true;
+        vm->running = false;
+    }
+
+    vm_schedule(vm);
+
+    return vm->running;
+}
+
+/* Set the next event, after a change of budget or counters */
+void vm_schedule(vm_t *vm) {
+    uint64_t count = vm->counters[VM_COUNTER_INSTRUCTIONS];
+    uint64_t next = (count | METRICS_INTERVAL) + 1;
+
+    if (vm->budget > count && vm->budget < next) {
+        next = vm->budget;
+    }
+
+    vm->event_at = next;
+}
+
+/* Run a guest function until it returns, calls go through perf_call */
+static void vm_run_frame(vm_t *vm, void *arg) {
+    size_t frame = vm->sp;
+
+    while (vm->running && vm->pc < vm->code_size && vm->sp <= frame) {
+        uint8_t opcode = vm->memory[vm->pc];
+        vm_execute(vm);
+
+        if (opcode == OP_CALL && vm->running) {
+            perf_call(vm, vm_run_frame, arg);
+        }
+    }
+}
+
 /* Run VM */
 void vm_run(vm_t *vm) {
     logger_print("Starting VM execution...\n");
-    while (vm->running && vm->pc < vm->code_size) {
-        vm_execute(vm);
+    vm_schedule(vm);
+    sample_attach(vm);
+    metrics_attach(vm);
+
+    vm_guard_t guard;
+    vm_guard_enter(vm, &guard);
+    if (!VM_GUARD_TRY(&guard)) {
+        vm_guard_fault(&guard);     // Guest memory fault, the run is over
+    } else if (vm->perf) {
+        perf_call(vm, vm_run_frame, NULL);
+    } else {
+        while (vm->running && vm->pc < vm->code_size) {
+            vm_execute(vm);
+        }
     }
+    vm_guard_leave(&guard);
+
+    metrics_detach(vm);
+    sample_attach(NULL);
     
     if (vm->running) {
         logger_print("VM execution completed\n");
     }
+
+    if (vm->thread_id == 0) {
+        vm_join_all(vm);
+    }
 }
 
@@ -0,0 +1,276 @@
+/* 
+ *
+ *      vmem.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#if defined(__linux__)
+    #define _GNU_SOURCE     // memfd_create
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+#include "logger.h"
+#include "vmem.h"
+
+/* Host page size */
+size_t vmem_page_size(void) {
+    static size_t page_size = 0;
+
+    if (page_size == 0) {
+        #if defined(_WIN32)
+            page_size = 4096;
+        #else
+            long size = sysconf(_SC_PAGESIZE);
+            page_size = (size > 0) ? (size_t)size : 4096;
+        #endif
+    }
+
+    return page_size;
+}
+
+/* Round size up to whole pages */
+size_t vmem_round(size_t size) {
+    size_t page_size = vmem_page_size();
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/* Mask applied to guest addresses: a power of two covering the memory and at least one
+ * guard page after it, SIZE_MAX if there is no such size */
+size_t vmem_mask(size_t size) {
+    size_t needed = vmem_round(size) + vmem_page_size();
+    size_t span = vmem_page_size();
+
+    while (span < needed) {
+        if (span > SIZE_MAX / 2) {
+            return SIZE_MAX;
+        }
+        span *= 2;
+    }
+
+    return span - 1;
+}
+
+/* Address space reserved for guest memory: everything a masked access of up to 8 bytes
+ * can reach, only the memory itself is accessible */
+size_t vmem_reserved(size_t size) {
+    size_t mask = vmem_mask(size);
+    return (mask == SIZE_MAX) ? 0 : mask + 1 + vmem_page_size();
+}
+
+/* Reserve the whole span inaccessible, then open the memory itself */
+static uint8_t *vmem_reserve(size_t size) {
+    size_t reserved = vmem_reserved(size);
+    if (reserved == 0) {
+        return NULL;
+    }
+
+    #if defined(_WIN32)
+        /* No guard pages, masked accesses stay in zeroed memory */
+        return (uint8_t *)calloc(reserved, 1);
+    #else
+        void *memory = mmap(NULL, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return (memory == MAP_FAILED) ? NULL : (uint8_t *)memory;
+    #endif
+}
+
+/* Allocate zeroed guest memory followed by guard pages, pages are only backed once touched */
+uint8_t *vmem_alloc(size_t size) {
+    uint8_t *memory = vmem_reserve(size);
+
+    if (memory && !vmem_protect(memory, vmem_round(size), VMEM_WRITE)) {
+        vmem_free(memory, size);
+        return NULL;
+    }
+
+    return memory;
+}
+
+void vmem_free(uint8_t *memory, size_t size) {
+    if (memory == NULL) {
+        return;
+    }
+
+    #if defined(_WIN32)
+        (void)size;
+        free(memory);
+    #else
+        munmap(memory, vmem_reserved(size));
+    #endif
+}
+
+/* Set the access of whole pages of guest memory, VMEM_NONE turns them into guard pages */
+bool vmem_protect(uint8_t *addr, size_t size, int access) {
+    #if defined(_WIN32)
+        (void)addr; (void)size; (void)access;
+        return true;
+    #else
+        int prot = (access == VMEM_WRITE) ? PROT_READ | PROT_WRITE : (access == VMEM_READ) ? PROT_READ : PROT_NONE;
+        return size == 0 || mprotect(addr, vmem_round(size), prot) == 0;
+    #endif
+}
+
+/* Zero guest memory again, dropping the pages so an idle arena costs nothing */
+void vmem_reset(uint8_t *memory, size_t size) {
+    #if defined(__linux__)
+        if (madvise(memory, vmem_round(size), MADV_DONTNEED) == 0) {
+            return;
+        }
+    #endif
+
+    memset(memory, 0, size);
+}
+
+/* Zero guest memory again, keeping the pages. Only pages in core are written, so a
+ * run touching a few pages costs a few memsets and no faults on the next one.
+ * Mostly touched stretches are dropped as in vmem_reset */
+void vmem_clear(uint8_t *memory, size_t size) {
+    #if defined(__linux__)
+        size_t page = vmem_page_size();
+        size_t total = vmem_round(size) / page;
+        unsigned char resident[256];
+
+        for (size_t first = 0; first < total; first += sizeof(resident)) {
+            size_t count = (total - first < sizeof(resident)) ? total - first : sizeof(resident);
+            uint8_t *chunk = memory + first * page;
+
+            if (mincore(chunk, count * page, resident) != 0) {
+                vmem_reset(chunk, count * page);
+                continue;
+            }
+
+            size_t in_core = 0;
+            for (size_t i = 0; i < count; i++) {
+                in_core += resident[i] & 1;
+            }
+
+            if (in_core * 4 > count) {
+                vmem_reset(chunk, count * page);
+                continue;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                if (resident[i] & 1) {
+                    memset(chunk + i * page, 0, page);
+                }
+            }
+        }
+    #else
+        memset(memory, 0, size);
+    #endif
+}
+
+/* Map part of a file copy-on-write over guest memory, addr and offset must be page aligned */
+bool vmem_map_file(uint8_t *addr, size_t size, int fd, uint64_t offset, bool writable) {
+    #if defined(_WIN32)
+        (void)addr; (void)size; (void)fd; (void)offset; (void)writable;
+        return false;
+    #else
+        int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        void *mapped = mmap(addr, size, prot, MAP_PRIVATE | MAP_FIXED, fd, (off_t)offset);
+        return mapped != MAP_FAILED;
+    #endif
+}
+
+/* Replace a mapping with zero filled memory again, addr must be page aligned */
+bool vmem_map_zero(uint8_t *addr, size_t size) {
+    #if defined(_WIN32)
+        memset(addr, 0, size);
+        return true;
+    #else
+        void *mapped = mmap(addr, vmem_round(size), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        return mapped != MAP_FAILED;
+    #endif
+}
+
+/* Create an anonymous file to back shared guest memory */
+static int vmem_create_file(void) {
+    #if defined(__linux__)
+        return memfd_create("rvm-memory", MFD_CLOEXEC);
+    #else
+        const char *dir = getenv("TMPDIR");
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/rvm-memory-XXXXXX", dir ? dir : "/tmp");
+
+        int fd = mkstemp(path);
+        if (fd >= 0) {
+            unlink(path);
+        }
+        return fd;
+    #endif
+}
+
+/* Move guest memory into a file so it can be mapped copy-on-write by clones.
+ * The memory stays at the same address, privately mapped from the file.
+ * Returns the file descriptor, -1 on failure */
+int vmem_share(uint8_t *memory, size_t size) {
+    #if defined(_WIN32)
+        (void)memory; (void)size;
+        return -1;
+    #else
+        size_t rounded = vmem_round(size);
+        size_t page_size = vmem_page_size();
+
+        int fd = vmem_create_file();
+        if (fd < 0) {
+            return -1;
+        }
+
+        /* Sparse file, only pages holding data are written */
+        if (ftruncate(fd, (off_t)rounded) != 0) {
+            close(fd);
+            return -1;
+        }
+
+        for (size_t offset = 0; offset < rounded; offset += page_size) {
+            const uint8_t *page = memory + offset;
+            size_t i = 0;
+            while (i < page_size && page[i] == 0) i++;
+
+            if (i < page_size && pwrite(fd, page, page_size, (off_t)offset) != (ssize_t)page_size) {
+                close(fd);
+                return -1;
+            }
+        }
+
+        if (!vmem_map_file(memory, rounded, fd, 0, true)) {
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    #endif
+}
+
+/* Private copy-on-write mapping of shared guest memory, with the same guard pages */
+uint8_t *vmem_map_shared(int fd, size_t size) {
+    #if defined(_WIN32)
+        (void)fd; (void)size;
+        return NULL;
+    #else
+        uint8_t *memory = vmem_reserve(size);
+
+        if (memory && !vmem_map_file(memory, vmem_round(size), fd, 0, true)) {
+            vmem_free(memory, size);
+            return NULL;
+        }
+
+        return memory;
+    #endif
+}
@@ -0,0 +1,207 @@
+/* 
+ *
+ *      watch.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "vm.h"
+#include "vmem.h"
+#include "watch.h"
+
+/*
+ * Pages holding a watched range are read-only, so reads cost nothing. The first write
+ * faults, the handler makes the page writable again and asks for an event before the
+ * next instruction, then the write is retried. The event compares the ranges with their
+ * last contents, reports the ones that changed and protects the pages again.
+ */
+
+/* First byte of the page holding addr, and the end of the page holding the last byte */
+static size_t watch_page_start(size_t addr) {
+    return addr & ~(vmem_page_size() - 1);
+}
+
+static size_t watch_page_end(const struct vm_watch *watch) {
+    return vmem_round(watch->addr + watch->size);
+}
+
+/* Event before the next instruction, where vm_event calls vm_watch_check */
+static void watch_pending(vm_t *vm) {
+    vm->watch_pending = true;
+    vm->event_at = vm->counters[VM_COUNTER_INSTRUCTIONS];
+}
+
+static void watch_protect(vm_t *vm, const struct vm_watch *watch, int access) {
+    size_t start = watch_page_start(watch->addr);
+    vmem_protect(vm->memory + start, watch_page_end(watch) - start, access);
+}
+
+#if defined(_WIN32)
+
+bool vm_watch(vm_t *vm, size_t addr, size_t size, bool stop) {
+    (void)vm; (void)addr; (void)size; (void)stop;
+    logger_error("Watchpoints are not supported on this platform\n");
+    return false;
+}
+
+#else
+
+/* Report writes to size bytes at addr, pausing the VM after the write if stop is set */
+bool vm_watch(vm_t *vm, size_t addr, size_t size, bool stop) {
+    if (size == 0 || addr > vm->memory_size || size > vm->memory_size - addr) {
+        logger_error("Invalid watchpoint 0x%zx+%zu\n", addr, size);
+        return false;
+    }
+
+    if (vm->watches == NULL) {
+        vm->watches = (struct vm_watches *)calloc(1, sizeof(struct vm_watches));
+        if (vm->watches == NULL) {
+            logger_error("Failed to allocate watchpoints\n");
+            return false;
+        }
+    }
+
+    struct vm_watches *watches = vm->watches;
+    if (watches->count == VM_WATCHES) {
+        logger_error("Too many watchpoints, at most %d\n", VM_WATCHES);
+        return false;
+    }
+
+    struct vm_watch *watch = &watches->list[watches->count];
+    watch->copy = (uint8_t *)malloc(size);
+    if (watch->copy == NULL) {
+        logger_error("Failed to allocate watchpoints\n");
+        return false;
+    }
+
+    watch->addr = addr;
+    watch->size = size;
+    watch->stop = stop;
+    memcpy(watch->copy, vm->memory + addr, size);
+    watches->count++;
+
+    watch_protect(vm, watch, VMEM_READ);
+
+    return true;
+}
+
+#endif
+
+void vm_unwatch_all(vm_t *vm) {
+    struct vm_watches *watches = vm->watches;
+    if (watches == NULL || vm->thread_id != 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < watches->count; i++) {
+        watch_protect(vm, &watches->list[i], VMEM_WRITE);
+        free(watches->list[i].copy);
+    }
+    free(watches);
+
+    vm->watches = NULL;
+    vm->watch_pending = false;
+}
+
+/* Called by the fault handler for a write to guest memory at addr.
+ * True if the page is watched and the write can be retried */
+bool vm_watch_fault(vm_t *vm, size_t addr) {
+    struct vm_watches *watches = vm->watches;
+    if (watches == NULL) {
+        return false;
+    }
+
+    size_t page = watch_page_start(addr);
+
+    for (size_t i = 0; i < watches->count; i++) {
+        const struct vm_watch *watch = &watches->list[i];
+
+        if (page >= watch_page_start(watch->addr) && page < watch_page_end(watch)) {
+            vmem_protect(vm->memory + page, vmem_page_size(), VMEM_WRITE);
+            watch_pending(vm);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* The host is about to write guest memory, as a trap reading into a buffer does.
+ * Watched pages in the range are opened, the event checks them afterwards */
+void vm_watch_write(vm_t *vm, size_t addr, size_t size) {
+    struct vm_watches *watches = vm->watches;
+    if (watches == NULL || size == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < watches->count; i++) {
+        const struct vm_watch *watch = &watches->list[i];
+
+        if (addr < vmem_round(watch->addr + watch->size) && watch_page_start(watch->addr) < addr + size) {
+            watch_protect(vm, watch, VMEM_WRITE);
+            watch_pending(vm);
+        }
+    }
+}
+
+/* Print a value of up to 8 bytes, or the first byte that changed */
+static void watch_report(vm_t *vm, const struct vm_watch *watch) {
+    const uint8_t *now = vm->memory + watch->addr;
+
+    fprintf(stderr, "Watch 0x%zx+%zu written by instruction %llu, next position %zu: ",
+            watch->addr, watch->size, (unsigned long long)vm->counters[VM_COUNTER_INSTRUCTIONS], vm->pc);
+
+    if (watch->size <= 8) {
+        uint64_t before = 0, after = 0;
+        for (size_t i = 0; i < watch->size; i++) {
+            before |= (uint64_t)watch->copy[i] << (i * 8);
+            after |= (uint64_t)now[i] << (i * 8);
+        }
+        fprintf(stderr, "0x%llx -> 0x%llx\n", (unsigned long long)before, (unsigned long long)after);
+        return;
+    }
+
+    size_t i = 0;
+    while (now[i] == watch->copy[i]) i++;
+    fprintf(stderr, "byte +%zu 0x%02x -> 0x%02x\n", i, watch->copy[i], now[i]);
+}
+
+/* Report the watched ranges written since the last check and protect their pages again */
+void vm_watch_check(vm_t *vm) {
+    struct vm_watches *watches = vm->watches;
+    vm->watch_pending = false;
+
+    if (watches == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < watches->count; i++) {
+        struct vm_watch *watch = &watches->list[i];
+
+        if (memcmp(vm->memory + watch->addr, watch->copy, watch->size) != 0) {
+            watch_report(vm, watch);
+            memcpy(watch->copy, vm->memory + watch->addr, watch->size);
+
+            if (watch->stop) {
+                vm->paused = true;
+                vm->running = false;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < watches->count; i++) {
+        watch_protect(vm, &watches->list[i], VMEM_READ);
+    }
+}
@@ -0,0 +1,96 @@
+/* 
+ *
+ *      clonetest.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+/* Isolation of VMs made by vm_clone: a clone sees the template memory, its
+ * own writes stay private, and later template writes do not leak into it */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "instruction.h"
+#include "logger.h"
+#include "vm.h"
+#include "decode.h"
+
+#define MEMORY_SIZE     0x4000
+#define DATA            0x2000      // Byte checked by the test, on a page of its own
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "clonetest.c:%d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+int main(void) {
+    uint8_t code[] = { OP_HALT };
+    vm_t template_vm, first, second, third;
+
+    logger_set_verbose(false);
+    vm_init(&template_vm, code, sizeof(code), MEMORY_SIZE);
+    template_vm.memory[DATA] = 1;
+
+    /* Set up on the template, must not follow a clone */
+    decoded_program_t prog;
+    if (!decode_program(&prog, template_vm.memory, template_vm.code_size, template_vm.version)) {
+        return 1;
+    }
+    template_vm.program = &prog;
+
+    if (!vm_clone(&first, &template_vm)) {
+        return 1;
+    }
+    CHECK(first.memory != template_vm.memory);
+    CHECK(first.memory[DATA] == 1);
+    CHECK(first.program == NULL);
+    CHECK(first.metrics == NULL);
+
+    /* A clone writes its own copy */
+    first.memory[DATA] = 2;
+    CHECK(template_vm.memory[DATA] == 1);
+
+    if (!vm_clone(&second, &template_vm)) {
+        return 1;
+    }
+    CHECK(second.memory[DATA] == 1);
+
+    /* The template writes its own copy too, existing and new clones keep the frozen memory */
+    template_vm.memory[DATA] = 3;
+    CHECK(first.memory[DATA] == 2);
+    CHECK(second.memory[DATA] == 1);
+
+    if (!vm_clone(&third, &template_vm)) {
+        return 1;
+    }
+    CHECK(third.memory[DATA] == 1);
+
+    /* Each clone runs on its own registers */
+    vm_run(&first);
+    CHECK(first.halted && vm_status(&first) == 0);
+    CHECK(!second.halted);
+
+    vm_destroy(&third);
+    vm_destroy(&second);
+    vm_destroy(&first);
+    template_vm.program = NULL;
+    decode_free(&prog);
+    vm_destroy(&template_vm);
+
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
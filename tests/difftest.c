@@ -0,0 +1,478 @@
+/* 
+ *
+ *      difftest.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+/* Differential test of the execution engines: random valid programs are run
+ * by vm_execute and by the decoded engine in lockstep, one basic block at a
+ * time, and the whole VM state is compared after each block. Every fourth
+ * program is version 1 byte code with 8 registers */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "instruction.h"
+#include "logger.h"
+#include "trap.h"
+#include "vm.h"
+#include "bytecode.h"
+#include "decode.h"
+#include "guard.h"
+
+#define MAX_INSNS       256
+#define MEMORY_SIZE     0x2000
+#define DATA_BASE       0x1000      // Loads and stores go to [DATA_BASE, DATA_BASE + DATA_SIZE)
+#define DATA_SIZE       0x100
+#define STEPS           20000       // Instructions run per program
+
+struct gen_insn {
+    uint8_t opcode;
+    uint8_t regs[3];
+    uint64_t imm;
+    int target;                     // Instruction whose address is the immediate, -1 for none
+};
+
+struct program {
+    struct gen_insn insns[MAX_INSNS];
+    size_t count;
+    uint8_t code[MAX_INSNS * 10];
+    size_t size;
+};
+
+static uint64_t rng_state;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static uint64_t rng_below(uint64_t n) {
+    return rng() % n;
+}
+
+static uint8_t reg_mask = VM_REGISTER_MASK;    // Register operand bits of the program generated
+
+static uint8_t random_reg(void) {
+    return (uint8_t)rng_below(reg_mask + 1u);
+}
+
+/* Register operand byte, the engines only look at the bits in the mask of its version */
+static uint8_t reg_byte(uint8_t reg) {
+    return (uint8_t)((rng() & ~reg_mask) | reg);
+}
+
+static struct gen_insn *emit(struct program *p, uint8_t opcode) {
+    struct gen_insn *insn = &p->insns[p->count++];
+
+    memset(insn, 0, sizeof(*insn));
+    insn->opcode = opcode;
+    insn->target = -1;
+    for (int i = 0; i < 3; i++) {
+        insn->regs[i] = reg_byte(random_reg());
+    }
+    return insn;
+}
+
+static void emit_load(struct program *p, uint8_t reg, uint64_t imm, int target) {
+    struct gen_insn *insn = emit(p, OP_LOAD);
+    insn->regs[0] = reg_byte(reg);
+    insn->imm = imm;
+    insn->target = target;
+}
+
+static uint64_t random_value(void) {
+    switch (rng_below(4)) {
+        case 0: return rng_below(16);
+        case 1: return DATA_BASE + rng_below(DATA_SIZE - 8);
+        case 2: return (uint64_t)0 - rng_below(4);
+        default: return rng();
+    }
+}
+
+/* Random program ending with HLT. Branch targets are loaded into a register
+ * just before the branch, so they are always instruction starts */
+static void generate(struct program *p, size_t length) {
+    static const uint8_t alu[] = { OP_ADD, OP_SUB, OP_MULTI, OP_AND, OP_OR, OP_XOR, OP_CMP,
+                                   OP_SLT, OP_SLTU, OP_SLE, OP_SLEU, OP_SEL,
+                                   OP_FADDD, OP_FSUBD, OP_FMULD, OP_FDIVD, OP_FMAD, OP_FEQD, OP_FLTD, OP_FLED };
+    static const uint8_t branches[] = { OP_JUMP, OP_JNZ, OP_JZ, OP_LOOP, OP_CALL,
+                                        OP_BEQ, OP_BNE, OP_BLT, OP_BLTU };
+    static const size_t traps[] = { TRAP_PUTC, TRAP_GETC, TRAP_COUNTER, TRAP_PUTF };
+    static const uint8_t sized[] = { OP_LDB, OP_LDBS, OP_LDH, OP_LDHS, OP_LDW, OP_LDWS, OP_LDQ,
+                                     OP_STB, OP_STH, OP_STW, OP_STQ };
+
+    p->count = 0;
+
+    /* Something to pop */
+    for (int i = 0; i < 4; i++) {
+        emit(p, OP_PUSH);
+    }
+
+    /* Targets are picked among the first length instructions, fixed up below */
+    while (p->count + 3 < length) {
+        uint64_t kind = rng_below(100);
+
+        if (kind < 30) {
+            emit(p, alu[rng_below(sizeof(alu))]);
+        } else if (kind < 40) {
+            emit(p, (uint8_t[]){ OP_INCREASE, OP_DECREASE, OP_NOT, OP_MOV, OP_FSQRTD, OP_ITOF, OP_FTOI }[rng_below(7)]);
+        } else if (kind < 52) {
+            emit_load(p, random_reg(), random_value(), -1);
+        } else if (kind < 55) {
+            uint8_t divisor = random_reg();
+            emit_load(p, divisor, 1 + rng_below(1000), -1);
+            struct gen_insn *insn = emit(p, OP_DIVIDE);
+            insn->regs[2] = reg_byte(divisor);
+        } else if (kind < 61) {
+            /* Now and then outside memory, masked into it or onto the guard pages */
+            struct gen_insn *insn = emit(p, rng_below(2) ? OP_LA : OP_SA);
+            insn->imm = rng_below(16) ? DATA_BASE + rng_below(DATA_SIZE - 8) : random_value();
+        } else if (kind < 67) {
+            /* Sized access at base + offset, now and then outside memory */
+            uint8_t base = random_reg();
+            emit_load(p, base, rng_below(16) ? DATA_BASE + 32 + rng_below(DATA_SIZE - 72) : random_value(), -1);
+            struct gen_insn *insn = emit(p, sized[rng_below(sizeof(sized))]);
+            insn->regs[1] = reg_byte(base);
+            insn->imm = rng_below(64) - 32;
+        } else if (kind < 73) {
+            emit(p, rng_below(3) ? OP_PUSH : OP_POP);
+        } else if (kind < 85) {
+            uint8_t reg = random_reg();
+            emit_load(p, reg, 0, (int)rng_below(length));
+            struct gen_insn *insn = emit(p, branches[rng_below(sizeof(branches))]);
+            insn->regs[strlen(instruction_table[insn->opcode].operands) - 1] = reg_byte(reg);   // Last operand
+        } else if (kind < 87) {
+            emit(p, OP_RET);
+        } else if (kind < 92) {
+            uint8_t reg = random_reg();
+            emit_load(p, reg, traps[rng_below(sizeof(traps) / sizeof(traps[0]))], -1);
+            emit(p, OP_TRAP)->regs[0] = reg_byte(reg);
+        } else if (kind < 96) {
+            emit(p, OP_PRINT);
+        } else if (kind < 97) {
+            /* Self-modifying store into the code */
+            emit(p, OP_SA)->imm = rng_below(length * 4);
+        } else if (kind < 98) {
+            emit(p, OP_HALT);
+        } else {
+            emit(p, OP_FENCE);
+        }
+    }
+    emit(p, OP_HALT);
+
+    /* Lay out, then encode with the resolved targets */
+    size_t addr[MAX_INSNS];
+    size_t offset = 0;
+    for (size_t i = 0; i < p->count; i++) {
+        addr[i] = offset;
+        offset += instruction_length(p->insns[i].opcode);
+    }
+
+    p->size = 0;
+    for (size_t i = 0; i < p->count; i++) {
+        struct gen_insn *insn = &p->insns[i];
+        int reg = 0;
+
+        if (insn->target >= 0) {
+            insn->imm = addr[(size_t)insn->target < p->count ? (size_t)insn->target : p->count - 1];
+        }
+        if (insn->opcode == OP_SA && insn->imm < DATA_BASE && insn->imm + 8 > offset) {
+            insn->imm = (offset > 8) ? offset - 8 : 0;
+        }
+
+        p->code[p->size++] = insn->opcode;
+        for (const char *op = instruction_table[insn->opcode].operands; *op; op++) {
+            if (*op == 'i') {
+                for (int b = 0; b < 8; b++) {
+                    p->code[p->size++] = (uint8_t)(insn->imm >> (b * 8));
+                }
+            } else {
+                p->code[p->size++] = insn->regs[reg++];
+            }
+        }
+    }
+}
+
+static uint64_t memory_hash(const vm_t *vm) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i + 8 <= vm->memory_size; i += 8) {
+        uint64_t word;
+        memcpy(&word, vm->memory + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+struct engine {
+    vm_t vm;
+    char *output;
+    size_t output_size;
+};
+
+static void engine_init(struct engine *e, const uint8_t *code, size_t size, uint32_t version) {
+    vm_init(&e->vm, (uint8_t *)code, size, MEMORY_SIZE);
+    vm_set_version(&e->vm, version);
+    e->vm.input = NULL;
+    e->output = NULL;
+    e->output_size = 0;
+    e->vm.output = open_memstream(&e->output, &e->output_size);
+}
+
+static void engine_free(struct engine *e) {
+    fclose(e->vm.output);
+    free(e->output);
+    vm_destroy(&e->vm);
+}
+
+#define CHECK(what, x, y) do { \
+    if ((x) != (y)) { \
+        fprintf(stderr, "seed %llu, block %zu: %s differs, interpreter 0x%llx, decoded 0x%llx\n", \
+                (unsigned long long)seed, block, what, (unsigned long long)(x), (unsigned long long)(y)); \
+        return false; \
+    } \
+} while (0)
+
+/* Compare the VM state of both engines after a block */
+static bool compare(uint64_t seed, size_t block, struct engine *a, struct engine *b) {
+    vm_t *x = &a->vm;
+    vm_t *y = &b->vm;
+
+    CHECK("state", x->running, y->running || y->paused);
+    CHECK("halted", x->halted, y->halted);
+    CHECK("status", vm_status(x), vm_status(y));
+    /* Where the pc stops on a fault is not specified */
+    if (vm_status(x) == 0) {
+        CHECK("pc", x->pc, y->pc);
+    }
+    CHECK("sp", x->sp, y->sp);
+
+    for (int i = 0; i < VM_REGISTERS; i++) {
+        char name[8];
+        snprintf(name, sizeof(name), "R%d", i);
+        CHECK(name, x->registers[i], y->registers[i]);
+    }
+
+    CHECK("instructions", x->counters[VM_COUNTER_INSTRUCTIONS], y->counters[VM_COUNTER_INSTRUCTIONS]);
+    CHECK("branches", x->counters[VM_COUNTER_BRANCHES], y->counters[VM_COUNTER_BRANCHES]);
+    CHECK("memory accesses", x->counters[VM_COUNTER_MEMORY], y->counters[VM_COUNTER_MEMORY]);
+    CHECK("traps", x->counters[VM_COUNTER_TRAPS], y->counters[VM_COUNTER_TRAPS]);
+    CHECK("memory", memory_hash(x), memory_hash(y));
+
+    fflush(x->output);
+    fflush(y->output);
+    CHECK("output size", a->output_size, b->output_size);
+    CHECK("output", memcmp(a->output, b->output, a->output_size), 0);
+
+    return true;
+}
+
+/* False for an instruction whose result is not reproducible here: threads and
+ * traps other than PUTC, GETC, COUNTER and PUTF.
+ * Jumps into the middle of an instruction or into stored data decode them */
+static bool reproducible(const vm_t *vm) {
+    const uint8_t *code = vm->memory + vm->pc;
+    size_t length = instruction_length(code[0]);
+
+    if (length == 0 || vm->pc + length > vm->code_size) {
+        return true;    // Both engines stop on it
+    }
+
+    switch (code[0]) {
+        case OP_TRAP: {
+            size_t number = vm->registers[code[1] & vm->register_mask];
+            return number == TRAP_PUTC || number == TRAP_GETC || number == TRAP_COUNTER || number == TRAP_PUTF;
+        }
+
+        case OP_SPAWN:
+        case OP_JOIN:
+            return false;
+
+        default:
+            return true;
+    }
+}
+
+/* One instruction on the interpreter, a guest memory fault stops it as in vm_run */
+static void step(vm_t *vm) {
+    vm_guard_t guard;
+    vm_guard_enter(vm, &guard);
+    if (VM_GUARD_TRY(&guard)) {
+        vm_execute(vm);
+    } else {
+        vm_guard_fault(&guard);
+    }
+    vm_guard_leave(&guard);
+}
+
+static bool ends_block(uint8_t opcode) {
+    switch (opcode) {
+        case OP_HALT: case OP_JUMP: case OP_JNZ: case OP_JZ: case OP_LOOP:
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLTU:
+        case OP_CALL: case OP_RET: case OP_TRAP: case OP_SA:
+        case OP_STB: case OP_STH: case OP_STW: case OP_STQ:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/* Run one program on both engines, false on the first difference */
+static bool run_seed(uint64_t seed) {
+    static struct program p;
+
+    uint32_t version = (seed % 4 == 0) ? 1 : BYTECODE_VERSION;
+    reg_mask = vm_register_mask(version);
+
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    generate(&p, 8 + rng_below(MAX_INSNS - 8));
+
+    struct engine a, b;
+    engine_init(&a, p.code, p.size, version);
+    engine_init(&b, p.code, p.size, version);
+
+    decoded_program_t prog;
+    bool ok = decode_program(&prog, b.vm.memory, b.vm.code_size, version);
+
+    size_t steps = 0;
+    for (size_t block = 0; ok; block++) {
+        size_t n = 0;
+
+        /* Interpreter, one instruction at a time as vm_run does */
+        bool stop = false;
+        while (a.vm.running && a.vm.pc < a.vm.code_size && steps < STEPS) {
+            if (!reproducible(&a.vm)) {
+                stop = true;
+                break;
+            }
+
+            uint8_t opcode = a.vm.memory[a.vm.pc];
+            step(&a.vm);
+            n++;
+            steps++;
+            if (ends_block(opcode)) {
+                break;
+            }
+        }
+
+        /* Decoded engine, resumed for as many instructions */
+        b.vm.budget = b.vm.counters[VM_COUNTER_INSTRUCTIONS] + n;
+        if (b.vm.paused) {
+            b.vm.paused = false;
+            b.vm.running = true;
+        }
+        if (n > 0 && b.vm.running) {
+            vm_run_decoded(&b.vm, &prog);
+        }
+
+        ok = compare(seed, block, &a, &b);
+
+        if (stop || !a.vm.running || a.vm.pc >= a.vm.code_size || steps >= STEPS) {
+            break;
+        }
+    }
+
+    if (!ok) {
+        char path[64];
+        snprintf(path, sizeof(path), "difftest-%llu.bin", (unsigned long long)seed);
+        FILE *fp = fopen(path, "wb");
+        if (fp) {
+            /* Version 1 is the file without a header */
+            if (version > 1) {
+                uint8_t header[sizeof(bytecode_header_t)] = { 0 };
+                memcpy(header, BYTECODE_MAGIC, 4);
+                header[4] = (uint8_t)version;
+                fwrite(header, 1, sizeof(header), fp);
+            }
+            fwrite(p.code, 1, p.size, fp);
+            fclose(fp);
+            fprintf(stderr, "Program written to %s\n", path);
+        }
+    }
+
+    decode_free(&prog);
+    engine_free(&a);
+    engine_free(&b);
+
+    return ok;
+}
+
+/* A file without a header is version 1, where register bytes 8 to 15 still name R0 to R7 */
+static bool run_version1(void) {
+    static const uint8_t image[] = {
+        OP_LOAD, 0x09, 40, 0, 0, 0, 0, 0, 0, 0,     // LD R1 40
+        OP_LOAD, 0x0a, 2, 0, 0, 0, 0, 0, 0, 0,      // LD R2 2
+        OP_ADD, 0x0b, 0x09, 0x0a,                   // ADD R3 R1 R2
+        OP_HALT,
+    };
+
+    const uint8_t *code;
+    size_t code_size;
+    uint32_t version;
+    if (!bytecode_code(image, sizeof(image), &code, &code_size, &version) || version != 1) {
+        fprintf(stderr, "version 1: headerless file not read as version 1\n");
+        return false;
+    }
+
+    struct engine a, b;
+    engine_init(&a, code, code_size, version);
+    engine_init(&b, code, code_size, version);
+
+    decoded_program_t prog;
+    bool ok = decode_program(&prog, b.vm.memory, b.vm.code_size, version);
+
+    if (ok) {
+        vm_run(&a.vm);
+        vm_run_decoded(&b.vm, &prog);
+
+        for (int i = 0; i < VM_REGISTERS; i++) {
+            size_t expect = (i == 1) ? 40 : (i == 2) ? 2 : (i == 3) ? 42 : 0;
+            if (a.vm.registers[i] != expect || b.vm.registers[i] != expect) {
+                fprintf(stderr, "version 1: R%d is 0x%zx in the interpreter and 0x%zx decoded, expected 0x%zx\n",
+                        i, a.vm.registers[i], b.vm.registers[i], expect);
+                ok = false;
+            }
+        }
+    }
+
+    decode_free(&prog);
+    engine_free(&a);
+    engine_free(&b);
+
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t count = (argc > 1) ? strtoull(argv[1], NULL, 0) : 500;
+    uint64_t first = (argc > 2) ? strtoull(argv[2], NULL, 0) : 1;
+    uint64_t failed = 0;
+
+    logger_set_verbose(false);
+
+    for (uint64_t seed = first; seed < first + count; seed++) {
+        if (!run_seed(seed)) {
+            failed++;
+        }
+    }
+
+    printf("%llu of %llu programs differ\n", (unsigned long long)failed, (unsigned long long)count);
+
+    if (!run_version1()) {
+        failed++;
+    }
+
+    return failed ? 1 : 0;
+}
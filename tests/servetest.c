@@ -0,0 +1,189 @@
+/* 
+ *
+ *      servetest.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+/* Round trips through rvm --serve on a temporary socket: programs sent with
+ * --submit and --by-path echo their input back unchanged, with the exit
+ * status of the job, and files that are not byte code are refused */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "instruction.h"
+#include "trap.h"
+#include "serve.h"
+
+#define LARGE_INPUT     300000      // Bytes, several output frames
+
+static int failures;
+static char dir[] = "/tmp/rvm-servetest-XXXXXX";
+static char socket_path[64], program_path[64], bad_path[64], input_path[64], output_path[64];
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "servetest.c:%d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static size_t emit_load(uint8_t *code, size_t pos, uint8_t reg, uint64_t value) {
+    code[pos++] = OP_LOAD;
+    code[pos++] = reg;
+    for (int i = 0; i < 8; i++) {
+        code[pos++] = (uint8_t)(value >> (i * 8));
+    }
+    return pos;
+}
+
+/* Copy stdin to stdout with TRAP_GETC and TRAP_PUTC until EOF */
+static bool write_echo(const char *path) {
+    uint8_t code[64];
+    size_t pos = 0;
+    size_t loop = 50, end = 62;
+
+    pos = emit_load(code, pos, 1, TRAP_GETC);
+    pos = emit_load(code, pos, 2, TRAP_PUTC);
+    pos = emit_load(code, pos, 3, (uint64_t)-1);    // EOF
+    pos = emit_load(code, pos, 4, end);
+    pos = emit_load(code, pos, 5, loop);
+
+    const uint8_t body[] = {
+        OP_TRAP, 1, 0,          // loop: R0 = getc
+        OP_BEQ, 0, 3, 4,        // EOF ends
+        OP_TRAP, 2, 0,          // putc R0
+        OP_JUMP, 5,
+        OP_HALT,                // end
+    };
+    memcpy(code + pos, body, sizeof(body));
+    pos += sizeof(body);
+
+    FILE *fp = fopen(path, "wb");
+    bool ok = fp && fwrite(code, 1, pos, fp) == pos;
+    if (fp) fclose(fp);
+    return ok && pos == end + 1;
+}
+
+static bool write_file(const char *path, const void *data, size_t size) {
+    FILE *fp = fopen(path, "wb");
+    bool ok = fp && fwrite(data, 1, size, fp) == size;
+    if (fp) fclose(fp);
+    return ok;
+}
+
+/* Run rvm with stdin and stdout redirected, returns its exit status or -1 */
+static int run(char *const argv[], const char *in, const char *out) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (in && !freopen(in, "rb", stdin)) _exit(127);
+        if (out && !freopen(out, "wb", stdout)) _exit(127);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+/* Submit the program with input, the output must be the input again */
+static void check_echo(char *rvm, const char *input, size_t size, bool by_path) {
+    char *argv[] = { rvm, "--submit", socket_path, program_path, NULL, NULL };
+    if (by_path) {
+        argv[3] = "--by-path";
+        argv[4] = program_path;
+    }
+
+    CHECK(write_file(input_path, input, size));
+    CHECK(run(argv, input_path, output_path) == SERVE_OK);
+
+    FILE *fp = fopen(output_path, "rb");
+    char *output = (char *)malloc(size + 1);
+    size_t n = (fp && output) ? fread(output, 1, size + 1, fp) : 0;
+    CHECK(n == size && memcmp(output, input, size) == 0);
+
+    free(output);
+    if (fp) fclose(fp);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || mkdtemp(dir) == NULL) {
+        fprintf(stderr, "Usage: rvm-servetest RVM\n");
+        return 1;
+    }
+
+    char *rvm = argv[1];
+    snprintf(socket_path, sizeof(socket_path), "%s/sock", dir);
+    snprintf(program_path, sizeof(program_path), "%s/echo.bin", dir);
+    snprintf(bad_path, sizeof(bad_path), "%s/bad.bin", dir);
+    snprintf(input_path, sizeof(input_path), "%s/in", dir);
+    snprintf(output_path, sizeof(output_path), "%s/out", dir);
+
+    /* Header of a byte code version no VM runs */
+    const uint8_t bad[] = { 0x7f, 'R', 'V', 'M', 0xff, 0xff, 0xff, 0xff, OP_HALT };
+    if (!write_echo(program_path) || !write_file(bad_path, bad, sizeof(bad))) {
+        return 1;
+    }
+
+    pid_t server = fork();
+    if (server == 0) {
+        freopen("/dev/null", "w", stderr);
+        execl(rvm, rvm, "--serve", socket_path, (char *)NULL);
+        _exit(127);
+    }
+
+    /* Wait for the socket */
+    struct stat st;
+    for (int i = 0; i < 500 && stat(socket_path, &st) != 0; i++) {
+        usleep(10000);
+    }
+    CHECK(stat(socket_path, &st) == 0);
+
+    check_echo(rvm, "hello, server\n", 14, false);
+    check_echo(rvm, "", 0, false);
+    check_echo(rvm, "by path", 7, true);
+
+    char *large = (char *)malloc(LARGE_INPUT);
+    for (size_t i = 0; large && i < LARGE_INPUT; i++) {
+        large[i] = (char)(i * 7 + (i >> 8));
+    }
+    if (large) check_echo(rvm, large, LARGE_INPUT, false);
+    free(large);
+
+    /* Not byte code, sent as a program and by path */
+    char *submit_bad[] = { rvm, "--submit", socket_path, bad_path, NULL };
+    CHECK(run(submit_bad, "/dev/null", "/dev/null") == SERVE_BAD_REQUEST);
+    char *path_bad[] = { rvm, "--submit", socket_path, "--by-path", bad_path, NULL };
+    CHECK(run(path_bad, "/dev/null", "/dev/null") == SERVE_BAD_REQUEST);
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+
+    unlink(socket_path);
+    unlink(program_path);
+    unlink(bad_path);
+    unlink(input_path);
+    unlink(output_path);
+    rmdir(dir);
+
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
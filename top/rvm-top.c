@@ -0,0 +1,154 @@
+/* 
+ *
+ *      rvm-top.c
+ * 
+ *      By Rainy101112 2026/10/19
+ *      Public under MIT license
+ * 
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "metrics.h"
+
+#define LOAD(field)     atomic_load_explicit(&(field), memory_order_relaxed)
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Map the segment of a process read-only */
+static const metrics_segment_t *open_segment(long pid) {
+    char name[64];
+    snprintf(name, sizeof(name), METRICS_NAME, pid);
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "No metrics for process %ld, is it running with --metrics?\n", pid);
+        return NULL;
+    }
+
+    void *segment = mmap(NULL, sizeof(metrics_segment_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (segment == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s\n", name);
+        return NULL;
+    }
+
+    const metrics_segment_t *metrics = (const metrics_segment_t *)segment;
+    if (memcmp(metrics->magic, METRICS_MAGIC, sizeof(metrics->magic)) != 0 ||
+        metrics->version != METRICS_VERSION || metrics->slots != METRICS_SLOTS) {
+        fprintf(stderr, "%s was written by another version of rvm\n", name);
+        munmap(segment, sizeof(metrics_segment_t));
+        return NULL;
+    }
+
+    return metrics;
+}
+
+static void show(const metrics_segment_t *metrics, bool alive) {
+    metrics_segment_t *m = (metrics_segment_t *)metrics;   // Loads only, atomics want non-const
+    uint64_t now = now_ns();
+    int running = 0;
+
+    printf("rvm %llu%s\n\n", (unsigned long long)m->pid, alive ? "" : " (exited)");
+    printf("%4s %6s %9s %10s %14s %10s %12s %12s %10s %9s %10s\n",
+           "SLOT", "THREAD", "TIME", "PC", "INSTRUCTIONS", "MIPS", "BRANCHES", "MEMORY OPS",
+           "TRAPS", "IO MS", "RSS KIB");
+
+    for (int i = 0; i < METRICS_SLOTS; i++) {
+        metrics_slot_t *slot = &m->slot[i];
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) != METRICS_RUNNING) {
+            continue;
+        }
+
+        uint64_t traps = 0;
+        for (int t = 0; t < METRICS_TRAPS; t++) {
+            traps += LOAD(slot->traps[t]);
+        }
+
+        uint64_t started = LOAD(slot->started_ns);
+        double seconds = (now > started) ? (double)(now - started) / 1e9 : 0.0;
+
+        printf("%4d %6u %8.1fs %#10llx %14llu %10.2f %12llu %12llu %10llu %9.1f %10llu\n",
+               i, (unsigned)LOAD(slot->thread_id), seconds,
+               (unsigned long long)LOAD(slot->pc),
+               (unsigned long long)LOAD(slot->instructions),
+               (double)LOAD(slot->ips) / 1e6,
+               (unsigned long long)LOAD(slot->branches),
+               (unsigned long long)LOAD(slot->memory_ops),
+               (unsigned long long)traps,
+               (double)LOAD(slot->io_ns) / 1e6,
+               (unsigned long long)(LOAD(slot->memory_peak) / 1024));
+        running++;
+    }
+
+    if (running == 0) {
+        printf("No VM running\n");
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    bool once = false;
+    int arg = 1;
+
+    if (arg < argc && strcmp(argv[arg], "--once") == 0) {
+        once = true;
+        arg++;
+    }
+
+    if (argc - arg < 1 || argc - arg > 2) {
+        printf("Usage: %s [--once] <PID> [SECONDS]\n", argv[0]);
+        printf("Shows the VMs of an rvm process started with --metrics\n");
+        return 1;
+    }
+
+    long pid = strtol(argv[arg], NULL, 10);
+    double interval = (argc - arg == 2) ? strtod(argv[arg + 1], NULL) : 1.0;
+    if (interval <= 0.0) {
+        interval = 1.0;
+    }
+
+    const metrics_segment_t *metrics = open_segment(pid);
+    if (metrics == NULL) {
+        return 1;
+    }
+
+    while (1) {
+        bool alive = kill((pid_t)pid, 0) == 0 || errno != ESRCH;
+
+        if (!once) {
+            printf("\033[H\033[J");
+        }
+        show(metrics, alive);
+
+        if (once || !alive) {
+            break;
+        }
+
+        struct timespec delay = { (time_t)interval, (long)((interval - (time_t)interval) * 1e9) };
+        nanosleep(&delay, NULL);
+    }
+
+    return 0;
+}